@@ -0,0 +1,585 @@
+//
+// optimastic_bench runs SGD, SVRG and Katyusha over a grid of
+// (objective, dimension, thread count) and records, for every run
+//
+// - steps/sec and ns per inner step, over the whole run
+// - the time of one snapshot (full) gradient at that thread count
+// - the wall time to reach a target relative suboptimality
+//   (f(x) - f*) <= target * (f(x0) - f*)
+//
+// as JSON or CSV, so that runs on different commits can be compared.
+//
+// Only optimizer time counts towards the timings; the objective is evaluated
+// between epochs with the clock stopped.
+//
+// Objectives:
+// quadratic - Quadratic<Dynamic> with coefficients in [0.5, 1.5]; f* in closed form
+// lsq       - LeastSquares<Dynamic> on a sparse, consistent system (f* = 0)
+// logistic  - LogisticRegression<Dynamic> on sparse samples with noisy labels;
+//             f* is estimated by full gradient descent before the runs
+//
+// N.B. Step sizes are fixed functions of the largest per-component Lipschitz
+// constant; this measures the code, not how well each method is tuned
+//
+
+// C includes
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+
+// C++ includes
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Optimastic includes
+#include "ioptimizer.hxx"
+#include "function.hxx"
+#include "finite_sum.hxx"
+#include "snapshot.hxx"
+#include "katyusha.hxx"
+#include "sgd.hxx"
+#include "svrg.hxx"
+#include "random.hxx"
+
+using namespace Optimastic;
+
+typedef std::vector<std::string> NameVec;
+typedef std::chrono::steady_clock Clock;
+
+struct BenchOptions {
+    NameVec methods;
+    NameVec objectives;
+    std::vector<size_t> dims;
+    std::vector<size_t> threads;
+
+    double target;            // relative suboptimality
+    double budget;            // seconds of optimizer time per run
+    size_t max_epochs;
+    size_t samples_per_dim;   // rows of the finite sum objectives, per dimension
+    size_t row_nnz;           // nonzeros per sample row
+    size_t batch_size;
+    bool   lazy;
+    size_t seed;
+
+    std::string format;
+    std::string output;
+    std::string data_dir;
+    std::string label;        // free-form tag, e.g. a commit hash
+};
+
+// One row of output
+struct BenchResult {
+    std::string method;
+    std::string objective;
+    size_t dim;
+    size_t components;
+    size_t threads;
+
+    size_t epochs;
+    size_t steps;
+    double seconds;
+    double snapshot_ms;       // NaN for methods without a snapshot gradient
+    double f_star;
+    double initial_subopt;
+    double final_subopt;
+    double time_to_target;    // NaN if the target wasn't reached
+};
+
+// Everything a run needs to know about an objective
+template <typename Function>
+struct Problem {
+    std::string name;
+    std::string path;         // dataset file behind f, if any; removed after the run
+    std::unique_ptr<Function> f;
+    VectorXd x0;
+    double f_star;
+    double lipschitz;         // largest per-component Lipschitz constant
+    double convexity;         // (estimate of the) strong convexity modulus
+
+    // N.B. Quadratic's full gradient is the sum of its partial gradients rather
+    // than their mean, so the variance reduced methods take steps this much smaller
+    double full_scale;
+};
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <typename T>
+static std::vector<T> split_list(const std::string &s) {
+    std::vector<T> ret;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        std::stringstream is(item);
+        T value;
+        is >> value;
+        ret.push_back(value);
+    }
+    return ret;
+}
+
+void usage(const char *argv0) {
+    printf("%s [options]\n"
+           "  -m, --methods     comma separated subset of SGD,SVRG,Katyusha\n"
+           "  -f, --objectives  comma separated subset of quadratic,lsq,logistic\n"
+           "  -d, --dims        comma separated dimensions (default 100,1000,10000)\n"
+           "  -t, --threads     comma separated thread counts (default 1,2,4)\n"
+           "  -r, --target      relative suboptimality to time (default 1e-4)\n"
+           "  -b, --budget      seconds of optimizer time per run (default 2)\n"
+           "  -e, --max_epochs  epochs per run (default 100)\n"
+           "  -n, --samples     finite sum rows per dimension (default 4)\n"
+           "  -z, --row_nnz     nonzeros per finite sum row (default 32)\n"
+           "  -B, --batch       components per inner step (default 1)\n"
+           "  -l, --lazy        lazy updates for SVRG and Katyusha\n"
+           "  -s, --seed        seed (default %d)\n"
+           "  -F, --format      json or csv (default json)\n"
+           "  -o, --output      output file (default optimastic_bench.<format>)\n"
+           "  -D, --data_dir    where the generated datasets go (default /tmp)\n"
+           "  -L, --label       tag stored with every result\n",
+           argv0, SEED);
+}
+
+void parse_args(int argc, char **argv, BenchOptions &opts) {
+    // Parse options
+    extern char *optarg;
+    int c;
+
+    while (true) {
+        static struct option long_options [] =
+        {
+            { "methods"   , required_argument, 0, 'm' },
+            { "objectives", required_argument, 0, 'f' },
+            { "dims"      , required_argument, 0, 'd' },
+            { "threads"   , required_argument, 0, 't' },
+            { "target"    , required_argument, 0, 'r' },
+            { "budget"    , required_argument, 0, 'b' },
+            { "max_epochs", required_argument, 0, 'e' },
+            { "samples"   , required_argument, 0, 'n' },
+            { "row_nnz"   , required_argument, 0, 'z' },
+            { "batch"     , required_argument, 0, 'B' },
+            { "lazy"      , no_argument      , 0, 'l' },
+            { "seed"      , required_argument, 0, 's' },
+            { "format"    , required_argument, 0, 'F' },
+            { "output"    , required_argument, 0, 'o' },
+            { "data_dir"  , required_argument, 0, 'D' },
+            { "label"     , required_argument, 0, 'L' },
+            { "help"      , no_argument      , 0, 'h' },
+            { 0           , 0                , 0, 0   }
+        };
+
+        int option_index = 0;
+        c = getopt_long (argc, argv, "m:f:d:t:r:b:e:n:z:B:ls:F:o:D:L:h",
+                long_options, &option_index);
+
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'm': opts.methods    = split_list<std::string>(optarg); break;
+            case 'f': opts.objectives = split_list<std::string>(optarg); break;
+            case 'd': opts.dims       = split_list<size_t>(optarg);      break;
+            case 't': opts.threads    = split_list<size_t>(optarg);      break;
+            case 'r': opts.target          = atof(optarg); break;
+            case 'b': opts.budget          = atof(optarg); break;
+            case 'e': opts.max_epochs      = atoi(optarg); break;
+            case 'n': opts.samples_per_dim = atoi(optarg); break;
+            case 'z': opts.row_nnz         = atoi(optarg); break;
+            case 'B': opts.batch_size      = atoi(optarg); break;
+            case 'l': opts.lazy            = true;         break;
+            case 's': opts.seed            = atoi(optarg); break;
+            case 'F': opts.format   = optarg; break;
+            case 'o': opts.output   = optarg; break;
+            case 'D': opts.data_dir = optarg; break;
+            case 'L': opts.label    = optarg; break;
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            case '?':
+                usage(argv[0]);
+                exit(1);
+            default:
+                std::cerr << "Parsing failed, aborting\n";
+                abort();
+        }
+    }
+
+    if (opts.format != "json" && opts.format != "csv") {
+        std::cerr << "Unknown format " << opts.format << ", aborting\n";
+        exit(1);
+    }
+    if (opts.output.empty()) {
+        opts.output = "optimastic_bench." + opts.format;
+    }
+}
+
+//
+// Objectives
+//
+
+Problem<Quadratic<Dynamic> > make_quadratic(size_t dim, std::mt19937 &gen) {
+    std::uniform_real_distribution<> coef_dist(0.5, 1.5);
+    std::normal_distribution<> norm_dist;
+
+    Quadratic<Dynamic>::Coefficients coef(dim), shift(dim);
+    for (size_t i=0; i<dim; i++) {
+        coef[i]  = coef_dist(gen);
+        shift[i] = norm_dist(gen);
+    }
+
+    Problem<Quadratic<Dynamic> > p;
+    p.name = "quadratic";
+    p.f.reset(new Quadratic<Dynamic>(coef, shift));
+    p.x0 = VectorXd::Zero(dim);
+    p.f_star = -0.5 * (shift.array().square() / coef.array()).sum();
+    p.lipschitz = coef.maxCoeff();
+    p.convexity = coef.minCoeff();
+    p.full_scale = dim;
+    return p;
+}
+
+// rows x dim samples with row_nnz nonzeros of variance 1/row_nnz per row, so
+// every |a_i|^2 is about 1
+SparseMatrix<double, RowMajor> random_samples(size_t rows, size_t dim, size_t row_nnz, std::mt19937 &gen) {
+    std::normal_distribution<> norm_dist(0.0, 1.0 / std::sqrt(double(row_nnz)));
+    std::uniform_int_distribution<int> col_dist(0, dim-1);
+    row_nnz = std::min(row_nnz, dim);
+
+    std::vector<Triplet<double> > entries;
+    entries.reserve(rows * row_nnz);
+    std::vector<int> cols;
+    for (size_t i=0; i<rows; i++) {
+        cols.clear();
+        while (cols.size() < row_nnz) {
+            int c = col_dist(gen);
+            if (std::find(cols.begin(), cols.end(), c) == cols.end()) {
+                cols.push_back(c);
+            }
+        }
+        for (int c : cols) {
+            entries.push_back(Triplet<double>(i, c, norm_dist(gen)));
+        }
+    }
+
+    SparseMatrix<double, RowMajor> A(rows, dim);
+    A.setFromTriplets(entries.begin(), entries.end());
+    return A;
+}
+
+template <typename Function>
+double max_lipschitz(const Function &f) {
+    std::vector<double> L = f.lipschitz_constants();
+    return *std::max_element(L.begin(), L.end());
+}
+
+Problem<LeastSquares<> > make_least_squares(size_t dim, const BenchOptions &opts, std::mt19937 &gen) {
+    std::normal_distribution<> norm_dist;
+    const size_t rows = opts.samples_per_dim * dim;
+    SparseMatrix<double, RowMajor> A = random_samples(rows, dim, opts.row_nnz, gen);
+
+    // Consistent system, so f* = 0
+    VectorXd x_star(dim);
+    for (size_t j=0; j<dim; j++) {
+        x_star[j] = norm_dist(gen);
+    }
+    VectorXd b = A * x_star;
+
+    std::string path = opts.data_dir + "/optimastic_bench_lsq_" + std::to_string(dim) + ".bin";
+    write_dataset(path, A, b);
+
+    Problem<LeastSquares<> > p;
+    p.name = "lsq";
+    p.path = path;
+    p.f.reset(new LeastSquares<>(path));
+    p.x0 = VectorXd::Zero(dim);
+    p.f_star = 0.0;
+    p.lipschitz = max_lipschitz(*p.f);
+    p.convexity = 1.0 / dim; // eigenvalues of A^T A / N are about 1/dim
+    p.full_scale = 1.0;
+    return p;
+}
+
+Problem<LogisticRegression<> > make_logistic(size_t dim, const BenchOptions &opts, std::mt19937 &gen) {
+    std::normal_distribution<> norm_dist;
+    const size_t rows = opts.samples_per_dim * dim;
+    SparseMatrix<double, RowMajor> A = random_samples(rows, dim, opts.row_nnz, gen);
+
+    // Labels from a planted model plus noise, which keeps the data from being
+    // separable (otherwise there is no minimum)
+    VectorXd w(dim);
+    for (size_t j=0; j<dim; j++) {
+        w[j] = norm_dist(gen);
+    }
+    VectorXd margins = A * w;
+    VectorXd b(rows);
+    for (size_t i=0; i<rows; i++) {
+        b[i] = (margins[i] + norm_dist(gen) > 0) ? 1.0 : -1.0;
+    }
+
+    std::string path = opts.data_dir + "/optimastic_bench_logistic_" + std::to_string(dim) + ".bin";
+    write_dataset(path, A, b);
+
+    Problem<LogisticRegression<> > p;
+    p.name = "logistic";
+    p.path = path;
+    p.f.reset(new LogisticRegression<>(path));
+    p.x0 = VectorXd::Zero(dim);
+    p.lipschitz = max_lipschitz(*p.f);
+    p.convexity = 0.1 / dim;
+    p.full_scale = 1.0;
+
+    // f* by Nesterov's accelerated gradient descent with step 1/L, where the mean
+    // of the per-sample constants bounds L for the average
+    // FIXME: A fixed iteration count; we should stop on the gradient norm instead
+    std::vector<double> Ls = p.f->lipschitz_constants();
+    const double L = std::accumulate(Ls.begin(), Ls.end(), 0.0) / Ls.size();
+    VectorXd x = p.x0, y = p.x0, x_prev = p.x0;
+    for (int k=1; k<=2000; k++) {
+        x_prev = x;
+        x = y - p.f->full_gradient(y) / L;
+        y = x + (k - 1.0) / (k + 2.0) * (x - x_prev);
+    }
+    p.f_star = (*p.f)(x);
+    return p;
+}
+
+//
+// Runs
+//
+
+// Milliseconds per full gradient, split across nthreads (see snapshot.hxx)
+template <typename Function>
+double time_snapshot(const Function &f, const VectorXd &x, size_t nthreads) {
+    SnapshotGradient<Function> snapshot;
+    snapshot.set_threads(nthreads);
+    snapshot.advance(f, x); // warm up the pool and the page cache
+
+    const int reps = 5;
+    Clock::time_point start = Clock::now();
+    for (int r=0; r<reps; r++) {
+        snapshot.advance(f, x);
+    }
+    return 1e3 * seconds_since(start) / reps;
+}
+
+// One epoch is num_components inner steps: SGD steps, one SVRG minibatch or one
+// Katyusha window
+template <typename Function>
+BenchResult run_method(const std::string &method, const Problem<Function> &p,
+                       size_t nthreads, double snapshot_ms, const BenchOptions &opts) {
+    const Function &f = *p.f;
+    const size_t N = f.num_components();
+    random_int prng(N, opts.seed);
+
+    std::unique_ptr<IOptimizer<Function> > opt;
+    size_t chunk = 1;
+    if (method == "SGD") {
+        // prefactor 1/(2L) for the first epoch, then decaying like 1/t
+        auto sgd = new SGD<Function>(f, p.x0, 0.5 * N / p.lipschitz, N, &prng);
+        sgd->set_num_threads(nthreads);
+        sgd->set_batch_size(opts.batch_size);
+        opt.reset(sgd);
+        chunk = N;
+        snapshot_ms = std::numeric_limits<double>::quiet_NaN();
+    } else if (method == "SVRG") {
+        // prefactor 1/(4L), decaying slowly enough to keep SVRG's linear rate for the run
+        const double decay = 100.0 * N;
+        auto svrg = new SVRG<Function>(f, p.x0, 0.25 * decay / (p.full_scale * p.lipschitz), decay, N, &prng);
+        svrg->set_num_threads(nthreads);
+        svrg->set_snapshot_threads(nthreads);
+        svrg->set_batch_size(opts.batch_size);
+        svrg->set_lazy_updates(opts.lazy);
+        opt.reset(svrg);
+    } else if (method == "Katyusha") {
+        auto katyusha = new Katyusha<Function>(f, p.x0, p.full_scale * p.lipschitz, p.convexity, N, false, &prng);
+        katyusha->set_snapshot_threads(nthreads);
+        katyusha->set_batch_size(opts.batch_size);
+        katyusha->set_lazy_updates(opts.lazy);
+        opt.reset(katyusha);
+    } else {
+        std::cerr << "Method name " << method << " not found, aborting\n";
+        abort();
+    }
+
+    BenchResult r;
+    r.method     = method;
+    r.objective  = p.name;
+    r.dim        = p.x0.size();
+    r.components = N;
+    r.threads    = nthreads;
+    r.snapshot_ms    = snapshot_ms;
+    r.f_star         = p.f_star;
+    r.initial_subopt = f(p.x0) - p.f_star;
+    r.final_subopt   = r.initial_subopt;
+    r.time_to_target = std::numeric_limits<double>::quiet_NaN();
+    r.epochs  = 0;
+    r.seconds = 0;
+
+    const size_t first_step = opt->_current_step;
+    while (r.epochs < opts.max_epochs && r.seconds < opts.budget) {
+        Clock::time_point start = Clock::now();
+        opt->run_optimizer(chunk);
+        r.seconds += seconds_since(start);
+        r.epochs++;
+
+        r.final_subopt = opt->min() - p.f_star;
+        if (std::isnan(r.time_to_target) && r.final_subopt <= opts.target * r.initial_subopt) {
+            r.time_to_target = r.seconds;
+        }
+        if (!std::isfinite(r.final_subopt)) {
+            break; // diverged
+        }
+    }
+    r.steps = opt->_current_step - first_step;
+    return r;
+}
+
+template <typename Function>
+void run_problem(const Problem<Function> &p, const BenchOptions &opts, std::vector<BenchResult> &results) {
+    for (size_t nthreads : opts.threads) {
+        const double snapshot_ms = time_snapshot(*p.f, p.x0, nthreads);
+        for (const std::string &method : opts.methods) {
+            std::cerr << method << " on " << p.name << "<" << p.x0.size() << ">, "
+                      << nthreads << " thread(s)\n";
+            results.push_back(run_method(method, p, nthreads, snapshot_ms, opts));
+        }
+    }
+}
+
+//
+// Output
+//
+
+// NaN means "not applicable"; it and infinities (diverged runs) become missing
+static std::string number_or(double value, const char *missing) {
+    if (!std::isfinite(value)) {
+        return missing;
+    }
+    std::ostringstream os;
+    os.precision(9);
+    os << value;
+    return os.str();
+}
+
+void write_results(const std::vector<BenchResult> &results, const BenchOptions &opts, std::ostream &out) {
+    out.precision(9);
+    const bool json = (opts.format == "json");
+    const char *missing = (json) ? "null" : "";
+
+    if (json) {
+        out << "{\n  \"label\": \"" << opts.label << "\",\n"
+            << "  \"target\": " << opts.target << ",\n"
+            << "  \"batch_size\": " << opts.batch_size << ",\n"
+            << "  \"lazy\": " << (opts.lazy ? "true" : "false") << ",\n"
+            << "  \"seed\": " << opts.seed << ",\n"
+            << "  \"results\": [\n";
+    } else {
+        out << "label,method,objective,dim,components,threads,batch_size,lazy,epochs,steps,seconds,"
+            << "steps_per_sec,ns_per_step,snapshot_ms,f_star,initial_subopt,final_subopt,time_to_target\n";
+    }
+
+    for (size_t k=0; k<results.size(); k++) {
+        const BenchResult &r = results[k];
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        const double steps_per_sec = (r.seconds > 0) ? r.steps / r.seconds : nan;
+        const double ns_per_step   = (r.steps > 0) ? 1e9 * r.seconds / r.steps : nan;
+
+        if (json) {
+            out << "    { \"method\": \"" << r.method << "\""
+                << ", \"objective\": \"" << r.objective << "\""
+                << ", \"dim\": " << r.dim
+                << ", \"components\": " << r.components
+                << ", \"threads\": " << r.threads
+                << ", \"epochs\": " << r.epochs
+                << ", \"steps\": " << r.steps
+                << ", \"seconds\": " << r.seconds
+                << ", \"steps_per_sec\": " << number_or(steps_per_sec, missing)
+                << ", \"ns_per_step\": " << number_or(ns_per_step, missing)
+                << ", \"snapshot_ms\": " << number_or(r.snapshot_ms, missing)
+                << ", \"f_star\": " << r.f_star
+                << ", \"initial_subopt\": " << r.initial_subopt
+                << ", \"final_subopt\": " << number_or(r.final_subopt, missing)
+                << ", \"time_to_target\": " << number_or(r.time_to_target, missing)
+                << " }" << (k+1 < results.size() ? "," : "") << "\n";
+        } else {
+            out << opts.label << "," << r.method << "," << r.objective << ","
+                << r.dim << "," << r.components << "," << r.threads << ","
+                << opts.batch_size << "," << (opts.lazy ? 1 : 0) << ","
+                << r.epochs << "," << r.steps << "," << r.seconds << ","
+                << number_or(steps_per_sec, missing) << ","
+                << number_or(ns_per_step, missing) << ","
+                << number_or(r.snapshot_ms, missing) << ","
+                << r.f_star << "," << r.initial_subopt << ","
+                << number_or(r.final_subopt, missing) << ","
+                << number_or(r.time_to_target, missing) << "\n";
+        }
+    }
+
+    if (json) {
+        out << "  ]\n}\n";
+    }
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    opts.methods    = split_list<std::string>("SGD,SVRG,Katyusha");
+    opts.objectives = split_list<std::string>("quadratic,lsq,logistic");
+    opts.dims       = split_list<size_t>("100,1000,10000");
+    opts.threads    = split_list<size_t>("1,2,4");
+    opts.target          = 1e-4;
+    opts.budget          = 2.0;
+    opts.max_epochs      = 100;
+    opts.samples_per_dim = 4;
+    opts.row_nnz         = 32;
+    opts.batch_size      = 1;
+    opts.lazy            = false;
+    opts.seed            = SEED;
+    opts.format          = "json";
+    opts.data_dir        = "/tmp";
+    parse_args(argc, argv, opts);
+
+    std::mt19937 gen(opts.seed);
+    std::vector<BenchResult> results;
+    for (const std::string &objective : opts.objectives) {
+        for (size_t dim : opts.dims) {
+            if (objective == "quadratic") {
+                run_problem(make_quadratic(dim, gen), opts, results);
+            } else if (objective == "lsq") {
+                Problem<LeastSquares<> > p = make_least_squares(dim, opts, gen);
+                run_problem(p, opts, results);
+                std::remove(p.path.c_str());
+            } else if (objective == "logistic") {
+                Problem<LogisticRegression<> > p = make_logistic(dim, opts, gen);
+                run_problem(p, opts, results);
+                std::remove(p.path.c_str());
+            } else {
+                std::cerr << "Objective " << objective << " not found, aborting\n";
+                abort();
+            }
+        }
+    }
+
+    std::ofstream out(opts.output.c_str());
+    if (!out) {
+        std::cerr << "Cannot open " << opts.output << "\n";
+        return 1;
+    }
+    write_results(results, opts, out);
+    std::cerr << "Wrote " << results.size() << " results to " << opts.output << "\n";
+
+    return 0;
+}
@@ -0,0 +1,270 @@
+#ifndef __DATASET_HXX__
+#define __DATASET_HXX__
+
+//
+// MappedDataset is a read-only view of a sample file that has been mmap'd rather
+// than read, so opening a data set costs little up front and the data set may be
+// larger than RAM (the kernel pages rows in and out as we touch them).
+//
+// The file is a compact CSR (compressed sparse row) layout, one row per sample,
+// in native byte order:
+//
+//   header     : char magic[8] = "OPTCSR01", uint64 nrows, uint64 ncols, uint64 nnz
+//   row_ptr    : uint64[nrows+1]   --- row i has entries [row_ptr[i], row_ptr[i+1])
+//   col_idx    : uint32[nnz]       --- strictly increasing within a row, followed by
+//                                      zero padding to an 8 byte boundary
+//   values     : double[nnz]
+//   labels     : double[nrows]
+//
+// write_dataset produces such a file from an Eigen row-major sparse matrix.
+//
+// The kernels index the iterate with col_idx and the arrays with row_ptr without
+// any bounds checks, so MappedDataset checks the structure (row_ptr and col_idx,
+// not the values) once when the file is opened; a corrupt or truncated file throws
+// there rather than reading out of bounds later.  That is one sequential pass over
+// the index arrays (about a third of the file), the only up front cost.
+//
+// N.B. POSIX only (mmap/madvise)
+//
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Eigen/Dense>
+#include <Eigen/SparseCore>
+
+namespace Optimastic {
+
+namespace dataset_detail {
+    static const char Magic[8] = { 'O', 'P', 'T', 'C', 'S', 'R', '0', '1' };
+
+    struct Header {
+        char     magic[8];
+        uint64_t nrows;
+        uint64_t ncols;
+        uint64_t nnz;
+    };
+
+    inline uint64_t padded_index_bytes(uint64_t nnz) {
+        return (nnz * sizeof(uint32_t) + 7) & ~uint64_t(7);
+    }
+
+    // N.B. Callers bound nrows and nnz first (see MappedDataset), so this can't wrap
+    inline uint64_t file_size(uint64_t nrows, uint64_t nnz) {
+        return sizeof(Header)
+            + (nrows+1) * sizeof(uint64_t)
+            + padded_index_bytes(nnz)
+            + nnz * sizeof(double)
+            + nrows * sizeof(double);
+    }
+} // namespace dataset_detail
+
+class MappedDataset {
+    public:
+        explicit MappedDataset(const std::string &path)
+            : _base(MAP_FAILED)
+            , _length(0)
+        {
+            using namespace dataset_detail;
+
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("MappedDataset: cannot open " + path);
+            }
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+                ::close(fd);
+                throw std::runtime_error("MappedDataset: " + path + " is too short");
+            }
+            _length = st.st_size;
+
+            _base = ::mmap(nullptr, _length, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd); // the mapping keeps the file alive
+            if (_base == MAP_FAILED) {
+                throw std::runtime_error("MappedDataset: cannot mmap " + path);
+            }
+
+            // Every row and every entry takes at least 8 bytes of the file, which
+            // bounds nrows and nnz well clear of overflowing file_size()
+            const Header *h = static_cast<const Header *>(_base);
+            if (std::memcmp(h->magic, Magic, sizeof(Magic)) != 0
+                    || h->nrows >= _length / sizeof(uint64_t)
+                    || h->nnz >= _length / sizeof(uint64_t)
+                    || file_size(h->nrows, h->nnz) != _length) {
+                ::munmap(_base, _length);
+                throw std::runtime_error("MappedDataset: " + path + " is not a CSR sample file");
+            }
+
+            _nrows = h->nrows;
+            _ncols = h->ncols;
+            _nnz   = h->nnz;
+
+            const char *p = static_cast<const char *>(_base) + sizeof(Header);
+            _row_ptr = reinterpret_cast<const uint64_t *>(p);
+            p += (_nrows+1) * sizeof(uint64_t);
+            _col_idx = reinterpret_cast<const uint32_t *>(p);
+            p += padded_index_bytes(_nnz);
+            _values  = reinterpret_cast<const double *>(p);
+            p += _nnz * sizeof(double);
+            _labels  = reinterpret_cast<const double *>(p);
+
+            ::madvise(_base, _length, MADV_SEQUENTIAL);
+            if (!valid_structure()) {
+                ::munmap(_base, _length);
+                throw std::runtime_error("MappedDataset: " + path + " has corrupt row_ptr or col_idx");
+            }
+
+            // The inner loops hit rows at random; full passes ask for read-ahead
+            // explicitly through prefetch()
+            ::madvise(_base, _length, MADV_RANDOM);
+        }
+
+        ~MappedDataset() {
+            if (_base != MAP_FAILED) {
+                ::munmap(_base, _length);
+            }
+        }
+
+        MappedDataset(const MappedDataset &) = delete;
+        MappedDataset &operator=(const MappedDataset &) = delete;
+
+        size_t rows() const { return _nrows; }
+        size_t cols() const { return _ncols; }
+        size_t nnz()  const { return _nnz; }
+
+        // Row accessors; the entries of row i are indices(i)[k], values(i)[k]
+        // for k in [0, row_nnz(i))
+        size_t row_nnz(size_t i) const {
+            return _row_ptr[i+1] - _row_ptr[i];
+        }
+
+        const uint32_t *indices(size_t i) const {
+            return _col_idx + _row_ptr[i];
+        }
+
+        const double *values(size_t i) const {
+            return _values + _row_ptr[i];
+        }
+
+        double label(size_t i) const {
+            return _labels[i];
+        }
+
+        // Ask the kernel to start reading rows [first, last) in the background
+        void prefetch(size_t first, size_t last) const {
+            if (first >= last) {
+                return;
+            }
+            advise(_col_idx + _row_ptr[first], _col_idx + _row_ptr[last]);
+            advise(_values  + _row_ptr[first], _values  + _row_ptr[last]);
+            advise(_labels  + first, _labels + last);
+        }
+
+    private:
+        // row_ptr must run monotonically from 0 to nnz, and each row's col_idx must
+        // be strictly increasing and < ncols
+        bool valid_structure() const {
+            if (_row_ptr[0] != 0 || _row_ptr[_nrows] != _nnz) {
+                return false;
+            }
+            for (size_t i=0; i<_nrows; i++) {
+                const uint64_t begin = _row_ptr[i], end = _row_ptr[i+1];
+                if (end < begin || end > _nnz) {
+                    return false;
+                }
+                for (uint64_t k=begin; k<end; k++) {
+                    if (_col_idx[k] >= _ncols || (k > begin && _col_idx[k] <= _col_idx[k-1])) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        template <typename T>
+        void advise(const T *begin, const T *end) const {
+            static const uintptr_t page = ::sysconf(_SC_PAGESIZE);
+            uintptr_t b = reinterpret_cast<uintptr_t>(begin) & ~(page-1);
+            uintptr_t e = reinterpret_cast<uintptr_t>(end);
+            if (e > b) {
+                ::madvise(reinterpret_cast<void *>(b), e - b, MADV_WILLNEED);
+            }
+        }
+
+        void   *_base;
+        size_t  _length;
+
+        size_t _nrows;
+        size_t _ncols;
+        size_t _nnz;
+
+        const uint64_t *_row_ptr;
+        const uint32_t *_col_idx;
+        const double   *_values;
+        const double   *_labels;
+};
+
+// write_dataset stores the rows of samples (one sample per row) together with
+// their labels in the format MappedDataset reads
+inline void write_dataset(const std::string &path,
+                          const Eigen::SparseMatrix<double, Eigen::RowMajor> &samples,
+                          const Eigen::VectorXd &labels) {
+    using namespace dataset_detail;
+
+    if (labels.size() != samples.rows()) {
+        throw std::runtime_error("write_dataset: need one label per sample");
+    }
+    // col_idx is stored as uint32; Eigen already keeps every index below cols()
+    if (uint64_t(samples.cols()) > uint64_t(std::numeric_limits<uint32_t>::max()) + 1) {
+        throw std::runtime_error("write_dataset: too many columns for 32 bit indices");
+    }
+
+    Eigen::SparseMatrix<double, Eigen::RowMajor> A = samples;
+    A.makeCompressed();
+
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("write_dataset: cannot open " + path);
+    }
+
+    Header h;
+    std::memcpy(h.magic, Magic, sizeof(Magic));
+    h.nrows = A.rows();
+    h.ncols = A.cols();
+    h.nnz   = A.nonZeros();
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+
+    for (Eigen::Index i=0; i<=A.rows(); i++) {
+        uint64_t r = A.outerIndexPtr()[i];
+        out.write(reinterpret_cast<const char *>(&r), sizeof(r));
+    }
+
+    for (Eigen::Index k=0; k<A.nonZeros(); k++) {
+        uint32_t c = A.innerIndexPtr()[k];
+        out.write(reinterpret_cast<const char *>(&c), sizeof(c));
+    }
+    static const char zeros[8] = {};
+    out.write(zeros, padded_index_bytes(h.nnz) - h.nnz * sizeof(uint32_t));
+
+    out.write(reinterpret_cast<const char *>(A.valuePtr()), h.nnz * sizeof(double));
+    out.write(reinterpret_cast<const char *>(labels.data()), h.nrows * sizeof(double));
+
+    if (!out) {
+        throw std::runtime_error("write_dataset: failed writing " + path);
+    }
+}
+
+} // namespace Optimastic
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef __DOMAIN_HXX__
+#define __DOMAIN_HXX__
+
+#include <type_traits>
+
+#include <Eigen/Dense>
+#include <Eigen/SparseCore>
+
+//
+// Helpers that let the optimizers treat the three supported kinds of Domain
+// the same way:
+//
+// 1. Matrix<double, n, 1>       --- fixed size, lives on the stack; best for small n
+// 2. Matrix<double, Dynamic, 1> --- (i.e. VectorXd) heap backed, size chosen at run-time
+// 3. SparseVector<double>       --- heap backed, only stores the nonzeros
+//
+// Element access in generic code should go through coeff() / coeffRef(), which
+// all three provide (SparseVector has no operator[]).
+//
+
+namespace Optimastic {
+
+template <typename Domain>
+struct is_sparse_domain : std::false_type {};
+
+template <typename Scalar, int Options, typename Index>
+struct is_sparse_domain<Eigen::SparseVector<Scalar, Options, Index> > : std::true_type {};
+
+// domain_zero returns the zero vector of a given size; for fixed-size domains
+// the size must match the compile-time dimension
+template <typename Domain>
+typename std::enable_if<!is_sparse_domain<Domain>::value, Domain>::type
+domain_zero(Eigen::Index size) {
+    return Domain::Zero(size);
+}
+
+template <typename Domain>
+typename std::enable_if<is_sparse_domain<Domain>::value, Domain>::type
+domain_zero(Eigen::Index size) {
+    return Domain(size);
+}
+
+// domain_from_dense converts a dense vector (e.g. an accumulator) into a Domain
+template <typename Domain, typename Dense>
+typename std::enable_if<!is_sparse_domain<Domain>::value, Domain>::type
+domain_from_dense(const Dense &v) {
+    return v;
+}
+
+template <typename Domain, typename Dense>
+typename std::enable_if<is_sparse_domain<Domain>::value, Domain>::type
+domain_from_dense(const Dense &v) {
+    return v.sparseView();
+}
+
+// domain_to_dense gives a dense view of a Domain, so that closed-form functions
+// can use (vectorized) Eigen expressions; it only copies for sparse domains
+template <typename Domain>
+typename std::enable_if<!is_sparse_domain<Domain>::value, const Domain &>::type
+domain_to_dense(const Domain &x) {
+    return x;
+}
+
+template <typename Domain>
+typename std::enable_if<is_sparse_domain<Domain>::value, Eigen::VectorXd>::type
+domain_to_dense(const Domain &x) {
+    return x.toDense();
+}
+
+} // namespace Optimastic
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef __FINITE_SUM_HXX__
+#define __FINITE_SUM_HXX__
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ifunction.hxx"
+#include "dataset.hxx"
+
+//
+// FiniteSum evaluates data-backed objectives of the form
+//
+// f(x) = 1/N * sum_i loss(<a_i, x>, b_i)
+//
+// where (a_i, b_i) is sample row i of a MappedDataset.  Here "partial gradient i"
+// is the gradient of the ith term, grad loss(<a_i, x>, b_i) = loss'(<a_i, x>, b_i) a_i,
+// which only touches the nonzero coordinates of a_i.  The full gradient and the
+// objective stream over the file block by block, so a snapshot pass never needs
+// the whole data set in memory.
+//
+// Samples are shared between copies (the optimizers take their function by value),
+// so copying a FiniteSum never copies or remaps the data.
+//
+
+namespace Optimastic {
+
+namespace finite_sum_detail {
+    // Row kernels.  A dense Domain gets Eigen's vectorized dot/axpy; sparse rows are
+    // gathered into a contiguous buffer first so the reduction still vectorizes.
+    // N.B. a row with as many nonzeros as columns is dense (indices are increasing)
+    static const size_t GatherChunk = 256;
+
+    template <typename Vec>
+    typename std::enable_if<!is_sparse_domain<Vec>::value, double>::type
+    row_dot(const double *val, const uint32_t *idx, size_t nnz, const Vec &x) {
+        typedef Map<const VectorXd> ConstMap;
+        if (nnz == size_t(x.size())) {
+            return ConstMap(val, nnz).dot(x);
+        }
+
+        double gathered[GatherChunk];
+        double z = 0.0;
+        for (size_t first=0; first<nnz; first+=GatherChunk) {
+            const size_t len = std::min(nnz - first, GatherChunk);
+            for (size_t k=0; k<len; k++) {
+                gathered[k] = x.coeff(idx[first+k]);
+            }
+            z += ConstMap(val + first, len).dot(ConstMap(gathered, len));
+        }
+        return z;
+    }
+
+    template <typename Vec>
+    typename std::enable_if<is_sparse_domain<Vec>::value, double>::type
+    row_dot(const double *val, const uint32_t *idx, size_t nnz, const Vec &x) {
+        double z = 0.0;
+        for (size_t k=0; k<nnz; k++) {
+            z += val[k] * x.coeff(idx[k]);
+        }
+        return z;
+    }
+
+    // y += a * row
+    template <typename Vec>
+    typename std::enable_if<!is_sparse_domain<Vec>::value>::type
+    row_axpy(double a, const double *val, const uint32_t *idx, size_t nnz, Vec &y) {
+        if (nnz == size_t(y.size())) {
+            y += a * Map<const VectorXd>(val, nnz);
+            return;
+        }
+        for (size_t k=0; k<nnz; k++) {
+            y.coeffRef(idx[k]) += a * val[k];
+        }
+    }
+
+    template <typename Vec>
+    typename std::enable_if<is_sparse_domain<Vec>::value>::type
+    row_axpy(double a, const double *val, const uint32_t *idx, size_t nnz, Vec &y) {
+        for (size_t k=0; k<nnz; k++) {
+            y.coeffRef(idx[k]) += a * val[k];
+        }
+    }
+} // namespace finite_sum_detail
+
+// loss(z, b) = 1/2 (z - b)^2
+struct SquaredLoss {
+    static double value(double z, double b) {
+        return 0.5 * (z-b) * (z-b);
+    }
+
+    static double derivative(double z, double b) {
+        return z-b;
+    }
+
+    // Upper bound on the second derivative in z
+    static double curvature() {
+        return 1.0;
+    }
+};
+
+// loss(z, b) = log(1 + exp(-b z)), for labels b in {-1, +1}
+struct LogisticLoss {
+    static double value(double z, double b) {
+        double m = -b * z;
+        return (m > 0) ? m + std::log1p(std::exp(-m)) : std::log1p(std::exp(m));
+    }
+
+    static double derivative(double z, double b) {
+        return -b / (1.0 + std::exp(b * z));
+    }
+
+    static double curvature() {
+        return 0.25;
+    }
+};
+
+template <typename Loss, int n = Dynamic, typename Vector = Matrix<double, n, 1> >
+struct FiniteSum final : public IFunction<FiniteSum<Loss, n, Vector>, n, Vector> {
+    typedef IFunction<FiniteSum<Loss, n, Vector>, n, Vector> Base;
+    typedef typename Base::Domain Domain;
+    typedef Matrix<double, n, 1> Accumulator;
+
+    // Rows are streamed block_rows at a time during full passes (0 means 1)
+    explicit FiniteSum(const std::string &path, size_t block_rows = 4096)
+        : _data(std::make_shared<const MappedDataset>(path))
+        , _block_rows((block_rows > 0) ? block_rows : 1)
+    {
+        check_dimension();
+    }
+
+    explicit FiniteSum(std::shared_ptr<const MappedDataset> data, size_t block_rows = 4096)
+        : _data(data)
+        , _block_rows((block_rows > 0) ? block_rows : 1)
+    {
+        check_dimension();
+    }
+
+    int dimension() const {
+        return _data->cols();
+    }
+
+    int num_components() const {
+        return _data->rows();
+    }
+
+    Domain full_gradient(const Domain &x) const {
+        Accumulator ret = Accumulator::Zero(dimension());
+        for_each_block(0, _data->rows(), [&](size_t i) {
+            axpy_row(Loss::derivative(margin(i, x), _data->label(i)), i, ret);
+        });
+        ret /= double(_data->rows());
+        return domain_from_dense<Domain>(ret);
+    }
+
+    // Rows [first, last) of the full gradient, streamed like full_gradient
+    template <typename Acc>
+    void accum_full_gradient(size_t first, size_t last, const Domain &x, Acc &grad) const {
+        const double scale = 1.0 / _data->rows();
+        for_each_block(first, last, [&](size_t i) {
+            axpy_row(scale * Loss::derivative(margin(i, x), _data->label(i)), i, grad);
+        });
+    }
+
+    double operator()(const Domain &x) const {
+        double ret = 0.0;
+        for_each_block(0, _data->rows(), [&](size_t i) {
+            ret += Loss::value(margin(i, x), _data->label(i));
+        });
+        return ret / _data->rows();
+    }
+
+    void accum_partial_gradient(int i, const Domain &x, Domain &grad, double step_size) const {
+        axpy_row(step_size * Loss::derivative(margin(i, x), _data->label(i)), i, grad);
+    }
+
+    // Every margin of a chunk is computed before any row is scattered into grad,
+    // so grad may alias x
+    void accum_partial_gradients(const int *indices, size_t count,
+                                 const Domain &x, Domain &grad, double step_size,
+                                 const double *weights = nullptr) const {
+        if (count > Base::BatchChunk && &x == &grad) {
+            const Domain x0 = x;
+            accum_partial_gradients(indices, count, x0, grad, step_size, weights);
+            return;
+        }
+
+        double coef[Base::BatchChunk];
+        for (size_t first=0; first<count; first+=Base::BatchChunk) {
+            const int *idx = indices + first;
+            const size_t len = std::min(count - first, size_t(Base::BatchChunk));
+            for (size_t k=0; k<len; k++) {
+                coef[k] = step_size * Loss::derivative(margin(idx[k], x), _data->label(idx[k]));
+            }
+            if (weights) {
+                for (size_t k=0; k<len; k++) {
+                    coef[k] *= weights[first+k];
+                }
+            }
+            for (size_t k=0; k<len; k++) {
+                axpy_row(coef[k], idx[k], grad);
+            }
+        }
+    }
+
+    // Each instance's margin is a strided gather over its own column of X, and is
+    // finished before that instance's row is scattered, so G may alias X
+    void accum_partial_gradients_soa(const int *indices, size_t count,
+                                     const double *X, double *G, size_t stride,
+                                     const double *steps) const {
+        for (size_t k=0; k<count; k++) {
+            const int i = indices[k];
+            const double   *val = _data->values(i);
+            const uint32_t *idx = _data->indices(i);
+            const size_t    nnz = _data->row_nnz(i);
+
+            double z = 0.0;
+            for (size_t j=0; j<nnz; j++) {
+                z += val[j] * X[idx[j]*stride + k];
+            }
+            const double coef = steps[k] * Loss::derivative(z, _data->label(i));
+            for (size_t j=0; j<nnz; j++) {
+                G[idx[j]*stride + k] += coef * val[j];
+            }
+        }
+    }
+
+    // The ith term only depends on the nonzeros of sample row i
+    void partial_support(int i, std::vector<int> &coords) const {
+        const uint32_t *idx = _data->indices(i);
+        coords.insert(coords.end(), idx, idx + _data->row_nnz(i));
+    }
+
+    // Lipschitz constant of each term's gradient, curvature * |a_i|^2; these are
+    // the weights for importance sampling (random_int::set_weights)
+    std::vector<double> lipschitz_constants() const {
+        std::vector<double> ret(_data->rows());
+        for_each_block(0, _data->rows(), [&](size_t i) {
+            const double *val = _data->values(i);
+            ret[i] = Loss::curvature() * Map<const VectorXd>(val, _data->row_nnz(i)).squaredNorm();
+        });
+        return ret;
+    }
+
+    const MappedDataset &data() const {
+        return *_data;
+    }
+
+    protected:
+        // <a_i, x>
+        double margin(size_t i, const Domain &x) const {
+            return finite_sum_detail::row_dot(_data->values(i), _data->indices(i), _data->row_nnz(i), x);
+        }
+
+        // y += a * a_i
+        template <typename Vec>
+        void axpy_row(double a, size_t i, Vec &y) const {
+            finite_sum_detail::row_axpy(a, _data->values(i), _data->indices(i), _data->row_nnz(i), y);
+        }
+
+        // Visit rows [begin, end) in order, prefetching one block ahead
+        template <typename Body>
+        void for_each_block(size_t begin, size_t end, Body body) const {
+            _data->prefetch(begin, std::min(begin + _block_rows, end));
+            for (size_t first=begin; first<end; first+=_block_rows) {
+                size_t last = std::min(first + _block_rows, end);
+                _data->prefetch(last, std::min(last + _block_rows, end));
+                for (size_t i=first; i<last; i++) {
+                    body(i);
+                }
+            }
+        }
+
+        void check_dimension() const {
+            if (n != Dynamic && size_t(n) != _data->cols()) {
+                throw std::runtime_error("FiniteSum: data set dimension does not match n");
+            }
+            // dimension() and num_components() are ints
+            if (_data->cols() > size_t(std::numeric_limits<int>::max())
+                    || _data->rows() > size_t(std::numeric_limits<int>::max())) {
+                throw std::runtime_error("FiniteSum: data set too large for int indices");
+            }
+        }
+
+        std::shared_ptr<const MappedDataset> _data;
+        size_t _block_rows;
+};
+
+// Least squares regression, f(x) = 1/(2N) * sum_i (<a_i, x> - b_i)^2
+template <int n = Dynamic, typename Vector = Matrix<double, n, 1> >
+using LeastSquares = FiniteSum<SquaredLoss, n, Vector>;
+
+// (Unregularized) logistic regression with labels in {-1, +1}
+template <int n = Dynamic, typename Vector = Matrix<double, n, 1> >
+using LogisticRegression = FiniteSum<LogisticLoss, n, Vector>;
+
+} // namespace Optimastic
+
+#endif
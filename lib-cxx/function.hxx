@@ -1,61 +1,130 @@
 #ifndef __FUNCTION_HXX__
 #define __FUNCTION_HXX__
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "ifunction.hxx"
 
-// Define a few basic functions 
-namespace Optimastic { 
+// Define a few basic functions
+namespace Optimastic {
 
 // Quadratic evaluates the gradient and partial
 // gradient for the function
 //
-// f(x) = 1/2 * c0 x0^2 + c1 * x1^2 + ... + ck xk^2 + b
+// f(x) = 1/2 * c0 x0^2 + ... + 1/2 * ck xk^2 + b0 x0 + ... + bk xk
 //
-// where b is a translation
+// where b is a translation (the minimum sits at x = -b/c)
 //
-template <int n>
-struct Quadratic : public IFunction<n> {
-    typedef typename IFunction<n>::Domain Domain;
-
-    // FIXME: This initializer is likely slow
-    Quadratic () 
-    {
-        for (int i=0; i<n; i++) {
-            _coefficients[i] = 1.0;
-            _shift[i]        = 0.0;
-        }
-    }
+// The coefficients and shift are always stored densely; only the iterate and
+// the gradients use the (possibly sparse) Domain type
+//
+template <int n, typename Vector = Matrix<double, n, 1> >
+struct Quadratic final : public IFunction<Quadratic<n, Vector>, n, Vector> {
+    typedef IFunction<Quadratic<n, Vector>, n, Vector> Base;
+    typedef typename Base::Domain Domain;
+    typedef Matrix<double, n, 1> Coefficients;
 
-    Quadratic (Domain & coefficients, Domain & shift)
+    // N.B. n == Dynamic requires an explicit dimension
+    explicit Quadratic (int dimension = n)
+        : _coefficients(Coefficients::Ones(dimension))
+        , _shift(Coefficients::Zero(dimension))
+    {}
+
+    Quadratic (const Coefficients & coefficients, const Coefficients & shift)
         : _coefficients(coefficients)
         , _shift(shift)
     {}
 
-    virtual Domain full_gradient(Domain &x) const { 
-        Domain ret;
-        for (int i=0; i<n; i++) { 
-            ret[i] = _coefficients[i] * x[i] + _shift[i];
+    int dimension() const {
+        return _coefficients.size();
+    }
+
+    Domain full_gradient(const Domain &x) const {
+        return domain_from_dense<Domain>(_coefficients.cwiseProduct(domain_to_dense(x)) + _shift);
+    }
+
+    template <typename Accumulator>
+    void accum_full_gradient(size_t first, size_t last, const Domain &x, Accumulator &grad) const {
+        for (size_t i=first; i<last; i++) {
+            grad[i] += _coefficients[i] * x.coeff(i) + _shift[i];
         }
-        return ret;
     }
 
-    virtual double operator()(const Domain &x) const {
-        double ret = 0.0;
-        for (int i=0; i<n; i++) { 
-            ret = _coefficients[i] * x[i] * x[i] + _shift[i];
+    double operator()(const Domain &x) const {
+        const auto &xd = domain_to_dense(x);
+        return (0.5 * _coefficients.array() * xd.array().square() + _shift.array() * xd.array()).sum();
+    }
+
+    void accum_partial_gradient(int i, const Domain &x, Domain &grad, double step_size) const {
+        grad.coeffRef(i) += step_size * (_coefficients[i] * x.coeff(i) + _shift[i]);
+    }
+
+    // Gather every partial of a chunk before scattering, so grad may alias x;
+    // the gather loop is what the compiler vectorizes (AVX2/AVX-512 gathers)
+    void accum_partial_gradients(const int *indices, size_t count,
+                                 const Domain &x, Domain &grad, double step_size,
+                                 const double *weights = nullptr) const {
+        if (count > Base::BatchChunk && &x == &grad) {
+            const Domain x0 = x;
+            accum_partial_gradients(indices, count, x0, grad, step_size, weights);
+            return;
         }
-        return ret;
+
+        double partials[Base::BatchChunk];
+        for (size_t first=0; first<count; first+=Base::BatchChunk) {
+            const int *idx = indices + first;
+            const size_t len = std::min(count - first, size_t(Base::BatchChunk));
+            for (size_t k=0; k<len; k++) {
+                partials[k] = step_size * (_coefficients[idx[k]] * x.coeff(idx[k]) + _shift[idx[k]]);
+            }
+            if (weights) {
+                for (size_t k=0; k<len; k++) {
+                    partials[k] *= weights[first+k];
+                }
+            }
+            for (size_t k=0; k<len; k++) {
+                grad.coeffRef(idx[k]) += partials[k];
+            }
+        }
+    }
+
+    // One coordinate per instance: gather, then scatter (G may alias X)
+    void accum_partial_gradients_soa(const int *indices, size_t count,
+                                     const double *X, double *G, size_t stride,
+                                     const double *steps) const {
+        double partials[Base::BatchChunk];
+        for (size_t first=0; first<count; first+=Base::BatchChunk) {
+            const int *idx = indices + first;
+            const size_t len = std::min(count - first, size_t(Base::BatchChunk));
+            for (size_t k=0; k<len; k++) {
+                const size_t at = idx[k] * stride + first + k;
+                partials[k] = steps[first+k] * (_coefficients[idx[k]] * X[at] + _shift[idx[k]]);
+            }
+            for (size_t k=0; k<len; k++) {
+                G[idx[k] * stride + first + k] += partials[k];
+            }
+        }
+    }
+
+    void partial_support(int i, std::vector<int> &coords) const {
+        coords.push_back(i);
     }
 
-    // FIXME: Check and ensure that the compiler inlines this
-    virtual void accum_partial_gradient(int i, Domain &x, Domain &grad, double step_size) const { 
-        grad[i] += step_size * _coefficients[i] * x[i] + _shift[i]; 
+    // Lipschitz constant of each partial gradient, for importance sampling
+    std::vector<double> lipschitz_constants() const {
+        std::vector<double> ret(dimension());
+        for (int i=0; i<dimension(); i++) {
+            ret[i] = std::abs(_coefficients[i]);
+        }
+        return ret;
     }
 
-    Domain _coefficients;
-    Domain _shift;
+    Coefficients _coefficients;
+    Coefficients _shift;
 };
 
 }; // namespace Optimastic
 
-#endif 
+#endif
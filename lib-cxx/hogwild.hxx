@@ -0,0 +1,173 @@
+#ifndef __HOGWILD_HXX__
+#define __HOGWILD_HXX__
+
+//
+// Helpers for running lock-free, Hogwild-style updates
+//
+// "Hogwild!: A Lock-Free Approach to Parallelizing Stochastic Gradient Descent"
+// Niu, Recht, Re, Wright, NIPS, 2011
+//
+// Every worker reads and writes the shared iterate without any locking.  That only
+// works as advertised when each step writes just the coordinates its partial
+// gradients touch (Function::partial_support): then, for sparse gradients,
+// collisions are rare and the lost updates don't hurt convergence.  A worker that
+// wrote every coordinate on every step would keep overwriting the other workers'
+// steps with its own stale copies, so the optimizers only run dense terms (SVRG's
+// snapshot gradient) through per-coordinate catch-up when threaded.
+//
+// N.B. The shared iterate must be a dense vector --- concurrent writes into a
+// SparseVector can reallocate its storage from underneath the other workers.
+//
+
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "thread_pool.hxx"
+
+namespace Optimastic {
+
+// StepRange is the arithmetic sequence of global step numbers first, first +
+// stride, ... (count of them) that one Hogwild worker runs; a range-for over it
+// yields the step numbers
+class StepRange {
+    public:
+        class iterator {
+            public:
+                iterator(size_t step, size_t stride)
+                    : _step(step)
+                    , _stride(stride)
+                {}
+
+                size_t operator*() const {
+                    return _step;
+                }
+
+                iterator &operator++() {
+                    _step += _stride;
+                    return *this;
+                }
+
+                bool operator!=(const iterator &other) const {
+                    return _step != other._step;
+                }
+
+            private:
+                size_t _step;
+                size_t _stride;
+        };
+
+        StepRange(size_t first, size_t stride, size_t count)
+            : _first(first)
+            , _stride(stride)
+            , _count(count)
+        {}
+
+        iterator begin() const {
+            return iterator(_first, _stride);
+        }
+
+        iterator end() const {
+            return iterator(_first + _count * _stride, _stride);
+        }
+
+        size_t size() const {
+            return _count;
+        }
+
+    private:
+        size_t _first;
+        size_t _stride;
+        size_t _count;
+};
+
+// HogwildWorkers keeps the nthreads-1 helper threads of a Hogwild run alive
+// between calls, so a short run (e.g. one SVRG minibatch) doesn't pay for thread
+// startup.  It owns a ThreadPool, so declare it last (see thread_pool.hxx)
+class HogwildWorkers {
+    public:
+        HogwildWorkers()
+            : _nthreads(1)
+        {}
+
+        void set_num_threads(size_t nthreads) {
+            _nthreads = (nthreads > 0) ? nthreads : 1;
+            if (_nthreads == 1) {
+                _pool.reset();
+            } else if (!_pool || _pool->size() != _nthreads-1) {
+                _pool.reset(new ThreadPool(_nthreads-1));
+            }
+        }
+
+        size_t num_threads() const {
+            return _nthreads;
+        }
+
+        // run splits the global steps [first_step, first_step + nsteps) over the
+        // workers and calls body(tid, prng, steps) for tid < num_threads(); steps is
+        // the StepRange worker tid owns.  The steps are interleaved, so that step
+        // dependent schedules (e.g. a decaying step size) match the serial run.
+        // Worker 0 draws from prng itself and worker tid from prng.split() number tid,
+        // split off serially so that a run is reproducible for a fixed thread count.
+        // run only returns once every worker has finished (i.e. this is the barrier
+        // that makes argmin() / min() safe to read afterwards).
+        //
+        // Worker 0 is the calling thread, so one thread runs serially with no overhead
+        // and draws the same numbers as a plain loop over prng
+        template <typename Prng, typename Body>
+        void run(Prng &prng, size_t first_step, size_t nsteps, Body body) {
+            if (_nthreads <= 1) {
+                body(size_t(0), prng, StepRange(first_step, 1, nsteps));
+                return;
+            }
+
+            std::vector<Prng> streams;
+            streams.reserve(_nthreads-1);
+            for (size_t tid=1; tid<_nthreads; tid++) {
+                streams.push_back(prng.split());
+            }
+
+            std::vector<std::future<void> > pending;
+            pending.reserve(_nthreads-1);
+            for (size_t tid=1; tid<_nthreads; tid++) {
+                StepRange steps = worker_steps(tid, first_step, nsteps);
+                Prng *stream = &streams[tid-1];
+                pending.push_back(_pool->submit([&body, tid, stream, steps] { body(tid, *stream, steps); }));
+            }
+
+            std::exception_ptr error;
+            try {
+                body(size_t(0), prng, worker_steps(0, first_step, nsteps));
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            // Every worker references body and streams, so all of them have to finish
+            // before any exception (ours first, then the workers' in tid order) leaves run
+            for (auto &p : pending) {
+                p.wait();
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            for (auto &p : pending) {
+                p.get();
+            }
+        }
+
+    private:
+        // Worker tid runs every _nthreads-th step starting at first_step + tid
+        StepRange worker_steps(size_t tid, size_t first_step, size_t nsteps) const {
+            size_t count = nsteps / _nthreads + (tid < nsteps % _nthreads ? 1 : 0);
+            return StepRange(first_step + tid, _nthreads, count);
+        }
+
+        size_t _nthreads;
+        std::unique_ptr<ThreadPool> _pool;
+};
+
+} // namespace Optimastic
+
+#endif
@@ -1,30 +1,140 @@
 #ifndef __IFUNCTION_HXX__
-#define __IFUNCTION_HXX__ 
+#define __IFUNCTION_HXX__
+
+#include <cstddef>
+#include <vector>
 
 #include <Eigen/Dense>
+#include <Eigen/SparseCore>
+
+#include "domain.hxx"
 
 /*
  * IFunction is an interface for what a function needs to contain
  * in order to implement SGD, SVRGD, SAGA, and Katyusha
  *
+ * The Domain defaults to a fixed-size vector on the stack; for large problems use
+ * n = Dynamic (a heap backed VectorXd whose size comes from dimension()) or pass a
+ * SparseVector<double> as the Domain type.  See domain.hxx.
+ *
+ * The interface is static (CRTP): a function derives from IFunction<Itself, n, Vector>
+ * and provides
+ *
+ *   int    dimension() const;
+ *   void   accum_partial_gradient(int i, const Domain &x, Domain &grad, double step_size) const;
+ *   Domain full_gradient(const Domain &x) const;
+ *   double operator() (const Domain &x) const;
+ *
+ * The optimizers are templated on the concrete function type, so every call below
+ * is resolved (and can be inlined) at compile time; there is no virtual dispatch
+ * in the inner loops.  The remaining members have defaults here that a function
+ * may shadow with something faster.
+ *
  */
 
 using namespace Eigen;
 
-namespace Optimastic { 
+namespace Optimastic {
+
+template <typename Derived, int n, typename Vector = Matrix<double, n, 1> >
+struct IFunction {
+    static const int Dimension = n;
+    typedef Vector Domain;
+
+    // Batched kernels work through their indices in chunks of this size
+    static const size_t BatchChunk = 64;
+
+    const Derived &derived() const {
+        return static_cast<const Derived &>(*this);
+    }
+
+    // Number of components i that accum_partial_gradient accepts, i.e. the range
+    // the PRNG should draw from.  For a closed-form function this is the number of
+    // coordinates; for a finite sum it is the number of samples
+    int num_components() const {
+        return derived().dimension();
+    }
+
+    // accum_partial_gradients is the minibatch form of accum_partial_gradient:
+    // it accumulates step_size * weights[k] * (partial gradient indices[k] at x)
+    // into grad for every k < count; weights == nullptr means all ones (weights
+    // carry the importance sampling corrections, see random.hxx).  Every partial
+    // gradient is evaluated at x as it was on entry, so grad may alias x.
+    //
+    // The default just loops (copying x first if it aliases grad); functions
+    // should shadow this with a kernel that vectorizes over the batch
+    void accum_partial_gradients(const int *indices, size_t count,
+                                 const Domain &x, Domain &grad, double step_size,
+                                 const double *weights = nullptr) const {
+        if (count > 1 && &x == &grad) {
+            const Domain x0 = x;
+            accum_partial_gradients(indices, count, x0, grad, step_size, weights);
+            return;
+        }
+        for (size_t k=0; k<count; k++) {
+            double step = (weights) ? step_size * weights[k] : step_size;
+            derived().accum_partial_gradient(indices[k], x, grad, step);
+        }
+    }
+
+    // accum_partial_gradients_soa is the instance-batched form used by MultiOptimizer
+    // (see multi_optimizer.hxx).  X and G hold count independent iterates side by side
+    // (structure of arrays: coordinate j of instance k lives at [j*stride + k]), and for
+    // every instance k it accumulates steps[k] * (partial gradient indices[k] at
+    // instance k of X) into instance k of G.  Each instance reads its iterate before
+    // writing, so G may alias X.
+    //
+    // The default goes through accum_partial_gradient one instance at a time, only
+    // gathering and scattering partial_support; functions should shadow this with a
+    // kernel that vectorizes across instances
+    void accum_partial_gradients_soa(const int *indices, size_t count,
+                                     const double *X, double *G, size_t stride,
+                                     const double *steps) const {
+        const int dim = derived().dimension();
+        static thread_local Domain x = domain_zero<Domain>(dim), g = domain_zero<Domain>(dim);
+        static thread_local std::vector<int> support;
+        if (x.size() != dim) {
+            x = domain_zero<Domain>(dim);
+            g = domain_zero<Domain>(dim);
+        }
+
+        for (size_t k=0; k<count; k++) {
+            support.clear();
+            derived().partial_support(indices[k], support);
+            for (int c : support) {
+                x.coeffRef(c) = X[c*stride + k];
+            }
+            derived().accum_partial_gradient(indices[k], x, g, steps[k]);
 
-template <int n>
-struct IFunction { 
-    static const int Dimension = n; 
-    typedef Matrix<double, n, 1> Domain;
+            // N.B. g is all zeros outside the support between calls
+            for (int c : support) {
+                G[c*stride + k] += g.coeff(c);
+                g.coeffRef(c) = 0;
+            }
+        }
+    }
 
-    // _partial_gradient takes in a gradient vector and accumulates 
-    // the ith partial derviative into this vector; this is to avoid 
-    // making more temporaries and copies of said radient
-    virtual void accum_partial_gradient(int i, Domain &x, Domain &grad, double step_size) const = 0;
-    virtual Domain full_gradient(Domain &x) const = 0;
+    // accum_full_gradient adds the contribution of components [first, last) to the
+    // full gradient into a dense accumulator, so that summing it over a partition of
+    // [0, num_components()) gives full_gradient(x); the parallel snapshot gradient
+    // (see snapshot.hxx) splits its work this way.  A function that can't be split
+    // leaves the default, which adds the whole gradient for the range starting at 0
+    template <typename Accumulator>
+    void accum_full_gradient(size_t first, size_t last, const Domain &x, Accumulator &grad) const {
+        if (first == 0 && last > 0) {
+            grad += domain_to_dense(derived().full_gradient(x));
+        }
+    }
 
-    virtual double operator() (const Domain &x) const = 0;
+    // partial_support appends every coordinate that accum_partial_gradient(i, ...)
+    // reads from x or writes into grad.  Hogwild workers and the lazy updates only
+    // touch these coordinates per step, so sparse functions should override
+    // this; the default (every coordinate) is always correct, just not any faster
+    void partial_support(int i, std::vector<int> &coords) const {
+        for (int j=0; j<derived().dimension(); j++) {
+            coords.push_back(j);
+        }
+    }
 };
 
 } // namespace Optimastic
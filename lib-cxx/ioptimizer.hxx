@@ -13,6 +13,12 @@
 // Principle (b) might be annoying to deal with when we have a Python interface...
 //
 
+#include <stdexcept>
+
+#include <Eigen/Core>
+
+#include "telemetry.hxx"
+
 namespace Optimastic { 
 
 template <typename Function>
@@ -20,6 +26,18 @@ struct IOptimizer {
     // Constants / Constraints from template arg
     typedef typename Function::Domain Domain;
 
+    IOptimizer(const Function &f) 
+        : _f(f)
+        , _current_step(0)
+        , _batch_size(1)
+    {}
+
+    virtual ~IOptimizer() {}
+
+    // Optimizers hold fixed-size Eigen members (the function, Domains), which
+    // need aligned storage when allocated with new
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
     // Accessors
     virtual const Domain& argmin() const = 0;
     virtual const double  min()    const = 0;
@@ -30,11 +48,42 @@ struct IOptimizer {
     // Print steps; this should print all types of step information
     virtual void print_step_state() const = 0;
 
+    // Number of components averaged per inner step; each inner step makes batched
+    // Function::accum_partial_gradients calls
+    void set_batch_size(size_t batch_size) {
+        _batch_size = (batch_size > 0) ? batch_size : 1;
+    }
+
+    size_t batch_size() const {
+        return _batch_size;
+    }
+
+    // Convergence traces; configure() sampling, then pop()/drain() records, possibly
+    // from another thread.  Compiled out unless OPTIMASTIC_TELEMETRY is defined (see
+    // telemetry.hxx)
+    Telemetry &telemetry() {
+        return _telemetry;
+    }
+
+    // The PRNG draws the components i handed to accum_partial_gradient, so it has
+    // to range over exactly [0, num_components()); e.g. for a FiniteSum that is the
+    // number of rows, not its dimension
+    template <typename Prng>
+    void check_prng(const Prng *prng) const {
+        if (!prng || prng->size() != _f.num_components()) {
+            throw std::invalid_argument("IOptimizer: the PRNG must draw from [0, num_components())");
+        }
+    }
+
     // FIXME: Only store a pointer/reference, eventually
     const Function _f; 
 
     // Counter
     size_t _current_step;
+
+    size_t _batch_size;
+
+    Telemetry _telemetry;
 };
 
 } // namespace Optimastic
@@ -2,12 +2,14 @@
 #define __KATYUSHA_HXX__
 
 #include <algorithm>
+#include <vector>
 
 #ifdef __DEBUG
 #include <iostream>
 #endif
 
 #include "random.hxx"
+#include "snapshot.hxx"
 #include "ifunction.hxx"
 #include "ioptimizer.hxx"
 
@@ -22,8 +24,8 @@ class Katyusha : public IOptimizer<Function> {
 
         Katyusha(Function f, Domain initial_position, 
                 double lipschitz_constant, double convexity_modulus, 
-                int window_size, bool proximal, random_int<Dimension> *prng_ptr) 
-            : _f(f)
+                int window_size, bool proximal, random_int *prng_ptr) 
+            : IOptimizer<Function>(f)
             , _x(initial_position)
             , _y(initial_position)
             , _z(initial_position)
@@ -33,8 +35,10 @@ class Katyusha : public IOptimizer<Function> {
             , _convexity_modulus(convexity_modulus)
             , _proximal(proximal)
             , _current_nwindows(0)
+            , _lazy(false)
             , _prng_ptr(prng_ptr)
         {
+            this->check_prng(prng_ptr);
 
             // Set up constants
             _tau1 = std::min(0.5, sqrt(window_size * convexity_modulus / (3*lipschitz_constant)));
@@ -50,12 +54,39 @@ class Katyusha : public IOptimizer<Function> {
                 _normalizer = r * (_normalizer+1); 
             }
             _normalizer = 1.0/_normalizer;
-
-            std::cout << "Constants [tau1, tau1, alpha, normalizer] = " << _tau1 << "," << _tau2 << "," << _alpha << "," << _normalizer << "\n";
         }
 
         void compute_single_window();
 
+        // Snapshot gradient options (see snapshot.hxx): split each full gradient across
+        // nthreads threads, and/or compute the next window's snapshot in the background
+        // while the current window runs.  A pipelined window still anchors x at
+        // last_mean, but its control variate is the snapshot from the window before
+        void set_snapshot_threads(size_t nthreads) { 
+            _snapshot.set_threads(nthreads);
+        }
+
+        void set_pipelined_snapshot(bool pipelined) { 
+            _snapshot.set_pipelined(pipelined);
+        }
+
+        // Lazy ("just-in-time") updates: a coordinate that the sampled partial gradient
+        // doesn't touch evolves by a fixed linear recurrence in (y, z, last_mean, full_grad),
+        // so rather than rebuilding x, y, z and the window average densely on every step
+        // we keep a per-coordinate timestamp and replay the skipped steps in closed form
+        // when Function::partial_support next touches the coordinate (and at window end).
+        // Cost per step is O(support) instead of O(n); the iterates are unchanged.
+        void set_lazy_updates(bool lazy) { 
+            _lazy = lazy;
+            if (_lazy) { 
+                build_lazy_tables();
+            }
+        }
+
+        bool lazy_updates() const { 
+            return _lazy;
+        }
+
         void increment_step() { 
             this->_current_step++;
         }
@@ -73,15 +104,19 @@ class Katyusha : public IOptimizer<Function> {
         }
 
         const double min() const {
-            return _f(_last_mean);
+            return this->_f(_last_mean);
         }
 
         void print_step_state() const { 
             std::cout << "Katyusha has completed " << _current_nwindows << " windows and " << this->_current_step << " total steps\n";
+            std::cout << "Constants [tau1, tau2, alpha, normalizer] = " << _tau1 << "," << _tau2 << "," << _alpha << "," << _normalizer << "\n";
         } 
 
     private: 
-        const Function _f;
+        void compute_single_window_dense();
+        void compute_single_window_lazy();
+        void build_lazy_tables();
+        void lazy_catch_up(int c, size_t step, const Domain &full_grad, Domain &accum_x);
 
         // Katyusha state 
         // x is the current position of the iteration
@@ -106,28 +141,60 @@ class Katyusha : public IOptimizer<Function> {
         bool _proximal;
         size_t _current_nwindows;
 
+        // Lazy update state; row m of _lazy_y / _lazy_acc holds the coefficients of
+        // (y, z, last_mean, full_grad) after m untouched steps (see build_lazy_tables)
+        bool _lazy;
+        Matrix<double, Dynamic, 4> _lazy_y;
+        Matrix<double, Dynamic, 4> _lazy_acc;
+        std::vector<double> _lazy_weight;
+        std::vector<size_t> _lazy_stamp;
+        std::vector<int>    _support;
+        Domain              _lazy_grad;
+
+        std::vector<int> _batch;
+        std::vector<double> _corrections;
+
         // PRNG
-        random_int<Dimension> *_prng_ptr;
+        random_int *_prng_ptr;
+
+        // Last (see thread_pool.hxx)
+        SnapshotGradient<Function> _snapshot;
 };
 
 template <typename Function>
 void Katyusha<Function>::compute_single_window() { 
+    this->_telemetry.begin_window(_current_nwindows);
+    if (_lazy) { 
+        compute_single_window_lazy();
+    } else { 
+        compute_single_window_dense();
+    }
+    this->_telemetry.end_window(_current_nwindows-1, this->_current_step, 
+        [&] { return min(); }, 
+        [&] { return this->_f.full_gradient(_last_mean).norm(); });
+}
+
+template <typename Function>
+void Katyusha<Function>::compute_single_window_dense() { 
     // First update mean
-    Domain full_grad = _f.full_gradient(_last_mean); 
+    _snapshot.advance(this->_f, _last_mean);
+    const Domain &full_grad = _snapshot.gradient();
     Domain accum_grad;  // For holding grad F(x) + grad_i F(x_proposed) - grad_i F(x)
-    Domain accum_x;
+    Domain accum_x = domain_zero<Domain>(_x.size());
     double curr_weight = 1;
+    const double scale = 1.0 / this->_batch_size;
+    _batch.resize(this->_batch_size);
 
-    for (int j=0; j<_window_size; j++) {
-       int i = _prng_ptr->generate(); 
+    for (size_t j=0; j<_window_size; j++) {
+       const double *weights = _prng_ptr->fill(_batch, _corrections);
 
         // Update x to x[k+1]
        _x = _tau1 * _z + _tau2 * _last_mean + (1-_tau1-_tau2) * _y;
 
        // Generate diff; note that this simply involves  
        accum_grad = full_grad;
-       _f.accum_partial_gradient(i, _x, accum_grad, 1.0); // + +grad_i(x)
-       _f.accum_partial_gradient(i, _last_mean, accum_grad, -1.0); // =grad_i(last_mean)
+       this->_f.accum_partial_gradients(_batch.data(), this->_batch_size, _x, accum_grad, scale, weights); // + +grad_i(x)
+       this->_f.accum_partial_gradients(_batch.data(), this->_batch_size, _snapshot.point(), accum_grad, -scale, weights); // =grad_i(snapshot)
 
        _z = _z - _alpha * accum_grad; // FIXME: This should be a proximal term in a full-optimization
 
@@ -140,8 +207,10 @@ void Katyusha<Function>::compute_single_window() {
 
        accum_x += curr_weight * _x;
        curr_weight *= (1+_alpha*_convexity_modulus);
-       
-       std::cout << "norms: " << _x.norm() << "," << _y.norm() << "," << _z.norm() << "\n"; 
+
+       if (this->_telemetry.step_sampled(this->_current_step)) { 
+           this->_telemetry.record_step(_current_nwindows, this->_current_step, _x.norm());
+       }
        
        // FIXME: Decay alpha?
        this->_current_step++;
@@ -151,6 +220,127 @@ void Katyusha<Function>::compute_single_window() {
     _current_nwindows++;
 }
 
+// For a coordinate whose partial gradient is just full_grad (i.e. one the sampled
+// component doesn't touch), a single inner step is
+//
+// x' = tau1 * z + tau2 * last_mean + (1-tau1-tau2) * y
+// z' = z - alpha * full_grad
+// y' = x' - c * full_grad,  c = 1/(3L) or tau1*alpha
+// accum_x += w * x',        w *= (1 + alpha*convexity_modulus)
+//
+// which is linear in (y, z, last_mean, full_grad).  Iterating it symbolically gives,
+// for every number of skipped steps m, y and the (relative) weighted sum of the x's
+template <typename Function>
+void Katyusha<Function>::build_lazy_tables() { 
+    typedef Matrix<double, 1, 4> Coef;
+    const double tau3 = 1 - _tau1 - _tau2;
+    const double c = (_proximal) ? 1.0/(3.0*_lipschitz_constant) : _tau1 * _alpha;
+    const double r = 1 + _alpha * _convexity_modulus;
+
+    _lazy_y.resize(_window_size+1, 4);
+    _lazy_acc.resize(_window_size+1, 4);
+    _lazy_weight.resize(_window_size+1);
+
+    Coef y(1, 0, 0, 0), z(0, 1, 0, 0), acc(0, 0, 0, 0);
+    const Coef anchor(0, 0, 1, 0), grad(0, 0, 0, 1);
+    double w = 1;
+
+    _lazy_y.row(0)   = y;
+    _lazy_acc.row(0) = acc;
+    _lazy_weight[0]  = 1;
+    for (size_t m=1; m<=_window_size; m++) { 
+        Coef x = _tau1 * z + _tau2 * anchor + tau3 * y;
+        acc += w * x;
+        z -= _alpha * grad;
+        y = x - c * grad;
+        w *= r;
+
+        _lazy_y.row(m)   = y;
+        _lazy_acc.row(m) = acc;
+        _lazy_weight[m]  = w;
+    }
+}
+
+// Replay the steps coordinate c missed since its timestamp, up to the start of step
+template <typename Function>
+void Katyusha<Function>::lazy_catch_up(int c, size_t step, const Domain &full_grad, Domain &accum_x) { 
+    const size_t m = step - _lazy_stamp[c]; // stamps never run ahead of step
+    if (m == 0) { 
+        return;
+    }
+
+    const double y = _y.coeff(c), z = _z.coeff(c);
+    const double anchor = _last_mean.coeff(c), grad = full_grad.coeff(c);
+    auto dot = [&](const Matrix<double, 1, 4> &k) { 
+        return k[0]*y + k[1]*z + k[2]*anchor + k[3]*grad;
+    };
+
+    _y.coeffRef(c) = dot(_lazy_y.row(m));
+    _z.coeffRef(c) = z - m * _alpha * grad;
+    accum_x.coeffRef(c) += _lazy_weight[_lazy_stamp[c]] * dot(_lazy_acc.row(m));
+    _lazy_stamp[c] = step;
+}
+
+template <typename Function>
+void Katyusha<Function>::compute_single_window_lazy() { 
+    _snapshot.advance(this->_f, _last_mean);
+    const Domain &full_grad = _snapshot.gradient();
+    Domain accum_x = domain_zero<Domain>(_x.size());
+    const int dim = _x.size();
+    const double tau3 = 1 - _tau1 - _tau2;
+    const double c_prox = (_proximal) ? 1.0/(3.0*_lipschitz_constant) : _tau1 * _alpha;
+
+    const double scale = 1.0 / this->_batch_size;
+
+    _lazy_stamp.assign(dim, 0);
+    if (_lazy_grad.size() != dim) { 
+        _lazy_grad = domain_zero<Domain>(dim);
+    }
+    _batch.resize(this->_batch_size);
+
+    for (size_t j=0; j<_window_size; j++) {
+        const double *weights = _prng_ptr->fill(_batch, _corrections);
+        _support.clear();
+        for (int i : _batch) { 
+            this->_f.partial_support(i, _support);
+        }
+
+        // Bring the support up to date and form x[k+1] on it
+        for (int c : _support) { 
+            lazy_catch_up(c, j, full_grad, accum_x);
+            _x.coeffRef(c) = _tau1 * _z.coeff(c) + _tau2 * _last_mean.coeff(c) + tau3 * _y.coeff(c);
+        }
+
+        // Sparse part of the gradient estimate, grad_i(x) - grad_i(snapshot)
+        this->_f.accum_partial_gradients(_batch.data(), this->_batch_size, _x, _lazy_grad, scale, weights);
+        this->_f.accum_partial_gradients(_batch.data(), this->_batch_size, _snapshot.point(), _lazy_grad, -scale, weights);
+
+        // Step the support; a stamp of j+1 marks a coordinate as done (support may repeat)
+        for (int c : _support) { 
+            if (_lazy_stamp[c] != j) { 
+                continue;
+            }
+            double g = full_grad.coeff(c) + _lazy_grad.coeff(c);
+            _lazy_grad.coeffRef(c) = 0;
+
+            _z.coeffRef(c) -= _alpha * g;
+            _y.coeffRef(c) = _x.coeff(c) - c_prox * g;
+            accum_x.coeffRef(c) += _lazy_weight[j] * _x.coeff(c);
+            _lazy_stamp[c] = j+1;
+        }
+
+        this->_current_step++;
+    }
+
+    // Flush
+    for (int c=0; c<dim; c++) { 
+        lazy_catch_up(c, _window_size, full_grad, accum_x);
+    }
+
+    _last_mean = _normalizer * accum_x; 
+    _current_nwindows++;
+}
+
 } // namespace SGD
 
 #endif 
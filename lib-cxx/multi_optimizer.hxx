@@ -0,0 +1,448 @@
+#ifndef __MULTI_OPTIMIZER_HXX__
+#define __MULTI_OPTIMIZER_HXX__
+
+//
+// MultiOptimizer advances K independent instances of SGD, SVRG or Katyusha on the
+// same function in lockstep, e.g. to sweep step sizes, window sizes or convexity
+// moduli, or to restart from many initial conditions.
+//
+// The state is stored as structure of arrays.  Instances are grouped into tiles of
+// Lanes (8, one cache line of doubles), and every state vector of a tile is one
+// dimension x Lanes row-major array, so coordinate j of the tile's instances is a
+// single fixed-size row.  That makes the dense part of each inner step (SGD's
+// velocity, SVRG's snapshot term, Katyusha's x/y/z updates) one vector operation
+// per coordinate with per-instance coefficients, and the sparse part one
+// Function::accum_partial_gradients_soa call per tile, instead of K optimizer
+// objects with their own virtual calls and scattered Domains.  (The lane count is
+// a compile time constant on purpose: with a runtime width, the per-row loop
+// setup costs more than the rows themselves.)  The last tile is padded out with
+// copies of the last instance, which are never reported.
+//
+// Tiles own their storage and never interact, so each one runs the whole of
+// run_optimizer on its own, spread over a thread pool.  Instance k draws its
+// indices from PRNG stream k, so results don't depend on the number of threads or
+// on how steps are split across run_optimizer calls, and instance k follows the
+// single-instance optimizer given random_int(num_components, seed, k) exactly.
+//
+// Differences from the single-instance optimizers:
+// - run_optimizer(k) always means k inner steps per instance; windows (SVRG
+//   minibatches, Katyusha windows) end independently per instance, which is what
+//   lets window sizes vary across a sweep
+// - one component per inner step, uniform sampling, serial snapshots
+// - dense Domains only
+//
+// FIXME: Every step sweeps a tile's whole state, so this pays off while a tile
+// stays in L1.  Past a few hundred coordinates Katyusha's seven state vectors
+// don't, and separate (lazy) Katyusha instances are faster
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "domain.hxx"
+#include "random.hxx"
+#include "thread_pool.hxx"
+
+namespace Optimastic {
+
+enum class MultiMethod { SGD, SVRG, Katyusha };
+
+// Per-instance settings; each method reads the ones the matching optimizer's
+// constructor takes and ignores the rest
+struct MultiSettings {
+    MultiSettings()
+        : step_size(1.0)
+        , decay_offset(1.0)
+        , friction_coefficient(0.0)
+        , mb_size(100)
+        , lipschitz_constant(1.0)
+        , convexity_modulus(0.0)
+        , window_size(100)
+        , proximal(false)
+    {}
+
+    // SGD and SVRG: prefactor = -step_size / (decay_offset + step)
+    double step_size;
+    double decay_offset;
+    double friction_coefficient; // SGD only
+
+    size_t mb_size;              // SVRG
+
+    // Katyusha; both must be positive (the default convexity_modulus of 0 has to
+    // be set)
+    double lipschitz_constant;
+    double convexity_modulus;
+    size_t window_size;
+    bool   proximal;
+};
+
+template <typename Function>
+class MultiOptimizer {
+    public:
+        static const int Dimension = Function::Dimension;
+        typedef typename Function::Domain Domain;
+
+        // Instances per tile
+        static const int Lanes = 8;
+
+        typedef Array<double, Dynamic, Lanes, RowMajor> State; // dimension x Lanes
+        typedef Array<double, 1, Lanes> Coefficients;          // one per instance
+
+        static_assert(!is_sparse_domain<Domain>::value, "MultiOptimizer needs a dense Domain");
+
+        // Column k of initial_conditions (dimension x K) starts instance k
+        MultiOptimizer(const Function &f, MultiMethod method,
+                       const MatrixXd &initial_conditions,
+                       const std::vector<MultiSettings> &settings,
+                       uint64_t seed = SEED)
+            : _f(f)
+            , _method(method)
+            , _settings(settings)
+            , _dim(f.dimension())
+            , _ninstances(initial_conditions.cols())
+            , _current_step(1) // actual step, not zero indexed, since we divide by this
+            , _nthreads(1)
+        {
+            if (settings.size() != _ninstances || _ninstances == 0) {
+                throw std::invalid_argument("MultiOptimizer: need one setting per initial condition");
+            }
+            if (initial_conditions.rows() != _dim) {
+                throw std::invalid_argument("MultiOptimizer: initial conditions must have the function's dimension");
+            }
+            for (const MultiSettings &s : settings) {
+                check(s);
+            }
+
+            // Pad out the last tile
+            const size_t ntiles = (_ninstances + Lanes - 1) / Lanes;
+            MatrixXd padded(_dim, ntiles * Lanes);
+            padded.leftCols(_ninstances) = initial_conditions;
+            for (size_t k=_ninstances; k<ntiles * Lanes; k++) {
+                padded.col(k) = initial_conditions.col(_ninstances - 1);
+                _settings.push_back(settings.back());
+            }
+
+            for (size_t first=0; first<_ninstances; first+=Lanes) {
+                _tiles.emplace_back(new Tile(first));
+                setup(*_tiles.back(), padded.middleCols(first, Lanes), seed);
+            }
+        }
+
+        MultiOptimizer(const MultiOptimizer &) = delete;
+
+        // _f may hold fixed-size Eigen members
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        // Number of threads the tiles are spread over
+        void set_num_threads(size_t nthreads) {
+            _nthreads = std::max(nthreads, size_t(1));
+            const size_t nworkers = std::min(_nthreads, _tiles.size());
+            if (nworkers <= 1) {
+                _pool.reset();
+            } else if (!_pool || _pool->size() != nworkers) {
+                _pool.reset(new ThreadPool(nworkers));
+            }
+        }
+
+        size_t num_threads() const {
+            return _nthreads;
+        }
+
+        size_t num_instances() const {
+            return _ninstances;
+        }
+
+        // k inner steps for every instance
+        void run_optimizer(size_t k) {
+            const size_t first_step = _current_step;
+            if (!_pool) {
+                for (auto &tile : _tiles) {
+                    run_tile(*tile, first_step, k);
+                }
+            } else {
+                std::vector<std::future<void> > pending;
+                for (auto &tile : _tiles) {
+                    Tile *t = tile.get();
+                    pending.push_back(_pool->submit([this, t, first_step, k] {
+                        run_tile(*t, first_step, k);
+                    }));
+                }
+                // Wait for every tile before get() can rethrow, since the tasks
+                // reference this
+                for (auto &p : pending) {
+                    p.wait();
+                }
+                for (auto &p : pending) {
+                    p.get();
+                }
+            }
+            _current_step += k;
+        }
+
+        // Results per instance, with the same meaning as the single-instance
+        // optimizers: SGD's iterate, SVRG's last minibatch result, Katyusha's last
+        // window mean
+        Domain argmin(size_t k) const {
+            const Tile &t = *_tiles[k / Lanes];
+            const State &result = (_method == MultiMethod::SGD) ? t.x : t.anchor;
+            return result.col(k % Lanes).matrix();
+        }
+
+        double min(size_t k) const {
+            return _f(argmin(k));
+        }
+
+        std::vector<double> mins() const {
+            std::vector<double> ret(_ninstances);
+            for (size_t k=0; k<_ninstances; k++) {
+                ret[k] = min(k);
+            }
+            return ret;
+        }
+
+        // Windows (SVRG minibatches / Katyusha windows) instance k has completed
+        size_t num_windows(size_t k) const {
+            return _tiles[k / Lanes]->nwindows[k % Lanes];
+        }
+
+        size_t current_step() const {
+            return _current_step;
+        }
+
+    private:
+        // Indices are drawn this many steps ahead, per instance, with one bulk fill
+        static const size_t DrawAhead = 64;
+
+        struct Tile {
+            explicit Tile(size_t first)
+                : first(first)
+                , nwindows(Lanes, 0)
+            {}
+
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+            size_t first;
+
+            // SGD:      x iterate, v velocity
+            // SVRG:     x mb_accum, anchor snapshot point (the last minibatch's result)
+            // Katyusha: x, y, z, anchor last_mean, v weighted sum of the window's x
+            State x, y, z, v;
+            State anchor;
+            State grad, full_grad;
+
+            Coefficients friction;
+            Coefficients tau1, alpha, prox_step, normalizer, weight, rate;
+
+            std::vector<random_int> prngs;
+            std::vector<size_t> nwindows;
+        };
+
+        // Settings that would divide by zero
+        void check(const MultiSettings &s) const {
+            if (_method == MultiMethod::SVRG && s.mb_size == 0) {
+                throw std::invalid_argument("MultiOptimizer: SVRG needs mb_size > 0");
+            }
+            if (_method == MultiMethod::Katyusha) {
+                if (s.window_size == 0) {
+                    throw std::invalid_argument("MultiOptimizer: Katyusha needs window_size > 0");
+                }
+                if (!(s.lipschitz_constant > 0) || !(s.convexity_modulus > 0)) {
+                    throw std::invalid_argument("MultiOptimizer: Katyusha needs positive lipschitz_constant and convexity_modulus");
+                }
+            }
+        }
+
+        template <typename Initial>
+        void setup(Tile &t, const Initial &initial, uint64_t seed) {
+            t.x = initial.array();
+
+            const int N = _f.num_components();
+            t.prngs.reserve(Lanes);
+            for (int k=0; k<Lanes; k++) {
+                t.prngs.emplace_back(N, seed, t.first + k);
+            }
+
+            switch (_method) {
+                case MultiMethod::SGD:
+                    t.v = State::Zero(_dim, int(Lanes));
+                    for (int k=0; k<Lanes; k++) {
+                        t.friction[k] = _settings[t.first+k].friction_coefficient;
+                    }
+                    break;
+
+                case MultiMethod::SVRG:
+                    t.anchor = t.x;
+                    t.full_grad = State(_dim, int(Lanes));
+                    for (int k=0; k<Lanes; k++) {
+                        snapshot(t, k);
+                    }
+                    break;
+
+                case MultiMethod::Katyusha:
+                    // Same constants as the Katyusha constructor, per instance
+                    for (int k=0; k<Lanes; k++) {
+                        const MultiSettings &s = _settings[t.first+k];
+                        t.tau1[k]  = std::min(0.5, std::sqrt(s.window_size * s.convexity_modulus / (3*s.lipschitz_constant)));
+                        t.alpha[k] = 1./(3*t.tau1[k]*s.lipschitz_constant);
+                        t.prox_step[k] = (s.proximal) ? 1.0/(3.0*s.lipschitz_constant) : t.tau1[k] * t.alpha[k];
+                        t.rate[k]   = 1 + t.alpha[k] * s.convexity_modulus;
+                        t.weight[k] = 1;
+
+                        double normalizer = 1;
+                        for (size_t i=0; i<s.window_size; i++) {
+                            normalizer = t.rate[k] * (normalizer+1);
+                        }
+                        t.normalizer[k] = 1.0/normalizer;
+                    }
+
+                    t.anchor = t.y = t.z = t.x;
+                    t.v = State::Zero(_dim, int(Lanes));
+                    t.grad = State(_dim, int(Lanes));
+                    t.full_grad = State(_dim, int(Lanes));
+                    for (int k=0; k<Lanes; k++) {
+                        snapshot(t, k);
+                    }
+                    break;
+            }
+        }
+
+        // Full gradient at the snapshot point of instance k of a tile; SVRG first
+        // moves its snapshot point to the current iterate
+        void snapshot(Tile &t, int k) {
+            if (_method == MultiMethod::SVRG) {
+                t.anchor.col(k) = t.x.col(k);
+            }
+            const Domain x = t.anchor.col(k).matrix();
+            t.full_grad.col(k) = _f.full_gradient(x).array();
+        }
+
+        // Steps [first_step, first_step + nsteps) for every instance of a tile
+        void run_tile(Tile &t, size_t first_step, size_t nsteps) {
+            std::vector<int> drawn(Lanes * DrawAhead);
+            int indices[Lanes];
+            Coefficients steps, scratch;
+
+            for (size_t j=0; j<nsteps; j++) {
+                // N.B. Never draw past nsteps, so the index stream doesn't depend on
+                // how the steps are split across run_optimizer calls
+                const size_t ahead = j % DrawAhead;
+                if (ahead == 0) {
+                    const size_t len = std::min(size_t(DrawAhead), nsteps - j);
+                    for (int k=0; k<Lanes; k++) {
+                        t.prngs[k].fill(drawn.data() + k*DrawAhead, len);
+                    }
+                }
+                for (int k=0; k<Lanes; k++) {
+                    indices[k] = drawn[k*DrawAhead + ahead];
+                }
+
+                const size_t step = first_step + j;
+                switch (_method) {
+                    case MultiMethod::SGD:      step_sgd(t, step, indices, steps);               break;
+                    case MultiMethod::SVRG:     step_svrg(t, step, indices, steps, scratch);     break;
+                    case MultiMethod::Katyusha: step_katyusha(t, step, indices, steps, scratch); break;
+                }
+            }
+        }
+
+        // The dense updates below go a row (one coordinate of all of a tile's
+        // instances) at a time, so every statement is a Lanes wide vector operation
+        // with per-instance coefficients
+
+        void step_sgd(Tile &t, size_t step, const int *indices, Coefficients &steps) {
+            for (int k=0; k<Lanes; k++) {
+                const MultiSettings &s = _settings[t.first+k];
+                steps[k] = -s.step_size / (s.decay_offset + step);
+            }
+
+            for (int j=0; j<_dim; j++) {
+                t.v.row(j) *= t.friction;
+            }
+            _f.accum_partial_gradients_soa(indices, Lanes, t.x.data(), t.v.data(), Lanes, steps.data());
+            t.x += t.v;
+        }
+
+        void step_svrg(Tile &t, size_t step, const int *indices,
+                       Coefficients &steps, Coefficients &negated) {
+            for (int k=0; k<Lanes; k++) {
+                const MultiSettings &s = _settings[t.first+k];
+                steps[k] = -s.step_size / (s.decay_offset + step);
+            }
+            negated = -steps;
+
+            // w[t] = w[t-1] - step * ( grad_i(w[t-1]) - grad_i(snapshot) + full_grad(snapshot) )
+            _f.accum_partial_gradients_soa(indices, Lanes, t.x.data(), t.x.data(), Lanes, steps.data());
+            _f.accum_partial_gradients_soa(indices, Lanes, t.anchor.data(), t.x.data(), Lanes, negated.data());
+            for (int j=0; j<_dim; j++) {
+                t.x.row(j) += steps * t.full_grad.row(j);
+            }
+
+            // SVRG steps are numbered from 1, so minibatch m ends at step m * mb_size
+            for (int k=0; k<Lanes; k++) {
+                if (step % _settings[t.first+k].mb_size == 0) {
+                    snapshot(t, k);
+                    t.nwindows[k]++;
+                }
+            }
+        }
+
+        void step_katyusha(Tile &t, size_t step, const int *indices,
+                           Coefficients &ones, Coefficients &negated_ones) {
+            // x[k+1] = tau1 z + tau2 last_mean + (1 - tau1 - tau2) y, with tau2 = 1/2,
+            // and the gradient estimate starts from the snapshot's full gradient
+            const Coefficients tau3 = 0.5 - t.tau1;
+            for (int j=0; j<_dim; j++) {
+                t.x.row(j) = t.tau1 * t.z.row(j) + 0.5 * t.anchor.row(j) + tau3 * t.y.row(j);
+                t.grad.row(j) = t.full_grad.row(j);
+            }
+
+            // + grad_i(x) - grad_i(last_mean)
+            ones.setOnes();
+            negated_ones.setConstant(-1.0);
+            _f.accum_partial_gradients_soa(indices, Lanes, t.x.data(), t.grad.data(), Lanes, ones.data());
+            _f.accum_partial_gradients_soa(indices, Lanes, t.anchor.data(), t.grad.data(), Lanes, negated_ones.data());
+
+            for (int j=0; j<_dim; j++) {
+                t.z.row(j) -= t.alpha * t.grad.row(j);
+                t.y.row(j)  = t.x.row(j) - t.prox_step * t.grad.row(j);
+                t.v.row(j) += t.weight * t.x.row(j);
+            }
+
+            // Katyusha steps are numbered from 1 here as well
+            for (int k=0; k<Lanes; k++) {
+                t.weight[k] *= t.rate[k];
+                if (step % _settings[t.first+k].window_size == 0) {
+                    t.anchor.col(k) = t.normalizer[k] * t.v.col(k);
+                    t.v.col(k).setZero();
+                    t.weight[k] = 1;
+                    snapshot(t, k);
+                    t.nwindows[k]++;
+                }
+            }
+        }
+
+        // FIXME: Only store a pointer/reference, eventually
+        const Function _f;
+        MultiMethod _method;
+        std::vector<MultiSettings> _settings;
+
+        const int    _dim;
+        const size_t _ninstances;
+        size_t _current_step;
+
+        std::vector<std::unique_ptr<Tile> > _tiles;
+
+        size_t _nthreads;
+
+        // Last (see thread_pool.hxx)
+        std::unique_ptr<ThreadPool> _pool;
+};
+
+} // namespace Optimastic
+
+#endif
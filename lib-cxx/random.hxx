@@ -2,43 +2,368 @@
 #define __RANDOM_HXX__
 
 //
-// This header defines a series of wrappers for the standard random number generators
-// that are standardized to our needs and let prngs be created as compile-time instead
-// of at run-time.
+// This header defines the index generators the optimizers draw components from.
 //
-// FIXME: 
-// 1. Use random123?
-// 2. Thread-safety?
-// 3. Seed randomization
+// The bits come from Philox4x32-10, a counter-based generator:
+//
+// "Parallel Random Numbers: As Easy as 1, 2, 3"
+// Salmon, Moraes, Dror, Shaw, SC, 2011
+//
+// Block k of stream s under seed is just philox(counter = (k, s), key = seed), so
+// streams are independent and reproducible no matter which thread draws from them,
+// there is no shared state to lock, and a run of blocks is a straight-line loop
+// the compiler vectorizes.
+//
+// On top of the bits, random_int draws indices in [0, size) either uniformly, in
+// proportion to per-component weights (Walker/Vose alias table, O(1) per draw), or
+// epoch by epoch without replacement.
+//
+// N.B. random_int itself is not thread-safe; give each thread its own split().
 //
 
 #define SEED 245201
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <numeric>
 #include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace Optimastic {
+
+// philox4x32 is a UniformRandomBitGenerator, so it also works with the
+// std:: distributions (e.g. std::normal_distribution for initial conditions)
+class philox4x32 {
+    public:
+        typedef uint32_t result_type;
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return 0xFFFFFFFFu; }
+
+        explicit philox4x32(uint64_t seed = SEED, uint64_t stream = 0)
+            : _key0(uint32_t(seed)), _key1(uint32_t(seed >> 32))
+            , _stream(stream)
+            , _block(0)
+            , _used(4)
+        {}
+
+        result_type operator()() {
+            if (_used == 4) {
+                next_block();
+            }
+            return _buffer[_used++];
+        }
+
+        // Same words as count calls to operator(), but whole blocks are generated
+        // Width at a time
+        void fill(uint32_t *out, size_t count) {
+            while (count > 0 && _used < 4) {
+                *out++ = _buffer[_used++];
+                count--;
+            }
+
+            const size_t nblocks = count / 4;
+            for (size_t b=0; b<nblocks; b+=Width) {
+                const size_t len = std::min(size_t(Width), nblocks - b);
+                generate_blocks(_block, len, out + 4*b);
+                _block += len;
+            }
+            out   += 4*nblocks;
+            count -= 4*nblocks;
+
+            for (size_t k=0; k<count; k++) {
+                out[k] = (*this)();
+            }
+        }
+
+        uint64_t stream() const {
+            return _stream;
+        }
 
-namespace Optimastic { 
-    template <int n>
-    struct random_int {
-        random_int<n>() {
-            // N.B. std::uniform_int_distribution *includes* the endpoints
-            dist = new std::uniform_int_distribution<int>(0,n-1);  
+        uint64_t seed() const {
+            return uint64_t(_key0) | (uint64_t(_key1) << 32);
         }
 
-        ~random_int<n>() { 
-            delete dist;
+        // Single block, for testing against the published known answers
+        static void block(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+            uint32_t c0[1] = { counter[0] }, c1[1] = { counter[1] };
+            uint32_t c2[1] = { counter[2] }, c3[1] = { counter[3] };
+            rounds<1>(c0, c1, c2, c3, key[0], key[1]);
+            out[0] = c0[0]; out[1] = c1[0]; out[2] = c2[0]; out[3] = c3[0];
         }
 
-        // For now, we'll make this noncopyable for now
-        random_int<n>(const random_int<n> &) = delete;
+    private:
+        static const size_t Width = 16;
 
+        // Ten Philox rounds over W independent counters, laid out as structure of
+        // arrays so that every statement is a W wide vector operation
+        template <size_t W>
+        static void rounds(uint32_t *c0, uint32_t *c1, uint32_t *c2, uint32_t *c3,
+                           uint32_t k0, uint32_t k1) {
+            for (int r=0; r<10; r++) {
+                for (size_t w=0; w<W; w++) {
+                    uint64_t p0 = uint64_t(0xD2511F53u) * c0[w];
+                    uint64_t p1 = uint64_t(0xCD9E8D57u) * c2[w];
+                    uint32_t n0 = uint32_t(p1 >> 32) ^ c1[w] ^ k0;
+                    uint32_t n2 = uint32_t(p0 >> 32) ^ c3[w] ^ k1;
+                    c1[w] = uint32_t(p1);
+                    c3[w] = uint32_t(p0);
+                    c0[w] = n0;
+                    c2[w] = n2;
+                }
+                k0 += 0x9E3779B9u;
+                k1 += 0xBB67AE85u;
+            }
+        }
+
+        void generate_blocks(uint64_t first, size_t len, uint32_t *out) const {
+            uint32_t c0[Width], c1[Width], c2[Width], c3[Width];
+            for (size_t w=0; w<Width; w++) {
+                c0[w] = uint32_t(first + w);
+                c1[w] = uint32_t((first + w) >> 32);
+                c2[w] = uint32_t(_stream);
+                c3[w] = uint32_t(_stream >> 32);
+            }
+            rounds<Width>(c0, c1, c2, c3, _key0, _key1);
+            for (size_t w=0; w<len; w++) {
+                out[4*w]   = c0[w];
+                out[4*w+1] = c1[w];
+                out[4*w+2] = c2[w];
+                out[4*w+3] = c3[w];
+            }
+        }
+
+        void next_block() {
+            uint32_t c[4] = { uint32_t(_block), uint32_t(_block >> 32),
+                              uint32_t(_stream), uint32_t(_stream >> 32) };
+            uint32_t k[2] = { _key0, _key1 };
+            block(c, k, _buffer);
+            _block++;
+            _used = 0;
+        }
+
+        uint32_t _key0, _key1;
+        uint64_t _stream;
+        uint64_t _block;
+
+        uint32_t _buffer[4];
+        int      _used;
+};
+
+// AliasTable samples i with probability weights[i] / sum(weights) from two
+// uniform words (Vose's variant of Walker's alias method)
+struct AliasTable {
+    explicit AliasTable(const std::vector<double> &weights)
+        : threshold(weights.size())
+        , alias(weights.size())
+        , correction(weights.size())
+    {
+        const size_t n = weights.size();
+        const double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+        if (n == 0 || !(total > 0)) {
+            throw std::invalid_argument("AliasTable: weights must have a positive sum");
+        }
+
+        // Scaled so that the average bucket holds exactly 1
+        std::vector<double> scaled(n);
+        std::vector<int> small, large;
+        for (size_t i=0; i<n; i++) {
+            if (weights[i] < 0) {
+                throw std::invalid_argument("AliasTable: weights must be nonnegative");
+            }
+            scaled[i] = weights[i] * n / total;
+            correction[i] = (weights[i] > 0) ? total / (n * weights[i]) : 0.0;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+
+        std::vector<double> prob(n, 1.0);
+        for (size_t i=0; i<n; i++) {
+            alias[i] = i;
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back(); small.pop_back();
+            int l = large.back();
+            prob[s]  = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
 
-        int generate() { 
-            return (*dist)(generator);
+        // Accept bucket j when a uniform word is below threshold[j]
+        for (size_t i=0; i<n; i++) {
+            threshold[i] = (prob[i] >= 1.0) ? 0xFFFFFFFFu : uint32_t(prob[i] * 4294967296.0);
         }
+    }
+
+    int sample(uint32_t bucket_word, uint32_t accept_word) const {
+        int j = (uint64_t(bucket_word) * threshold.size()) >> 32;
+        return (accept_word < threshold[j]) ? j : alias[j];
+    }
+
+    std::vector<uint32_t> threshold;
+    std::vector<int>      alias;
+
+    // 1 / (n p_i), which keeps importance sampled gradients unbiased
+    std::vector<double>   correction;
+};
+
+// The range [0, size) is a run-time argument, since it is the function's
+// num_components(), which need not be its (compile-time) dimension
+struct random_int {
+    // Generators with the same seed and different streams are independent
+    explicit random_int(int size, uint64_t seed = SEED, uint64_t stream = 0)
+        : generator(seed, stream)
+        , _size(size)
+        , _without_replacement(false)
+        , _epoch_pos(0)
+    {
+        if (size <= 0) {
+            throw std::invalid_argument("random_int: size must be positive");
+        }
+    }
+
+    // For now, we'll make this noncopyable for now; split() makes new streams
+    random_int(const random_int &) = delete;
+    random_int(random_int &&) = default;
+
+    // A new, independent stream with the same sampling scheme (e.g. for a worker
+    // thread).  The stream id is drawn from this generator, so repeated splits
+    // give different streams and the whole run stays reproducible
+    random_int split() {
+        uint64_t stream = uint64_t(generator()) | (uint64_t(generator()) << 32);
+        random_int ret(_size, generator.seed(), stream);
+        ret._alias = _alias;
+        ret._without_replacement = _without_replacement;
+        return ret;
+    }
+
+    int generate() {
+        if (_alias) {
+            uint32_t b = generator();
+            return _alias->sample(b, generator());
+        }
+        if (_without_replacement) {
+            return next_in_epoch();
+        }
+        return scale(generator());
+    }
+
+    // count draws, the same as calling generate() count times
+    void fill(int *out, size_t count) {
+        if (_without_replacement && !_alias) {
+            for (size_t k=0; k<count; k++) {
+                out[k] = next_in_epoch();
+            }
+            return;
+        }
+
+        const size_t words_per_draw = (_alias) ? 2 : 1;
+        for (size_t first=0; first<count; first+=FillChunk) {
+            const size_t len = std::min(count - first, size_t(FillChunk));
+            uint32_t words[2*FillChunk];
+            generator.fill(words, words_per_draw * len);
+            if (_alias) {
+                for (size_t k=0; k<len; k++) {
+                    out[first+k] = _alias->sample(words[2*k], words[2*k+1]);
+                }
+            } else {
+                for (size_t k=0; k<len; k++) {
+                    out[first+k] = scale(words[k]);
+                }
+            }
+        }
+    }
+
+    // fill, plus the importance sampling corrections for a batched gradient
+    // call; returns nullptr (and leaves corrections alone) when sampling is uniform
+    const double *fill(std::vector<int> &batch, std::vector<double> &corrections) {
+        fill(batch.data(), batch.size());
+        if (!_alias) {
+            return nullptr;
+        }
+        corrections.resize(batch.size());
+        for (size_t k=0; k<batch.size(); k++) {
+            corrections[k] = _alias->correction[batch[k]];
+        }
+        return corrections.data();
+    }
+
+    // Importance sampling: draw i with probability proportional to weights[i],
+    // typically the per-component Lipschitz constants.  The optimizers scale each
+    // partial gradient by correction(i) = 1/(size p_i) so steps stay unbiased
+    void set_weights(const std::vector<double> &weights) {
+        if (weights.size() != size_t(_size)) {
+            throw std::invalid_argument("random_int: need one weight per component");
+        }
+        _alias = std::make_shared<const AliasTable>(weights);
+    }
+
+    // Back to uniform draws
+    void clear_weights() {
+        _alias.reset();
+    }
+
+    bool weighted() const {
+        return bool(_alias);
+    }
+
+    double correction(int i) const {
+        return (_alias) ? _alias->correction[i] : 1.0;
+    }
+
+    // Sample every component exactly once per epoch, in a fresh random order
+    // each epoch (ignored while weights are set)
+    void set_without_replacement(bool without_replacement) {
+        _without_replacement = without_replacement;
+        _epoch.clear();
+        _epoch_pos = 0;
+    }
+
+    int size() const {
+        return _size;
+    }
+
+    philox4x32 generator;
+
+    private:
+        static const size_t FillChunk = 256;
+
+        // Multiply-shift onto [0, size); the bias is at most size/2^32
+        int scale(uint32_t word) const {
+            return (uint64_t(word) * _size) >> 32;
+        }
+
+        int next_in_epoch() {
+            if (_epoch_pos == _epoch.size()) {
+                if (_epoch.empty()) {
+                    _epoch.resize(_size);
+                    std::iota(_epoch.begin(), _epoch.end(), 0);
+                }
+                // Fisher-Yates
+                for (size_t k=_epoch.size()-1; k>0; k--) {
+                    size_t j = (uint64_t(generator()) * (k+1)) >> 32;
+                    std::swap(_epoch[k], _epoch[j]);
+                }
+                _epoch_pos = 0;
+            }
+            return _epoch[_epoch_pos++];
+        }
+
+        int _size;
+
+        std::shared_ptr<const AliasTable> _alias;
+
+        bool _without_replacement;
+        std::vector<int> _epoch;
+        size_t _epoch_pos;
+};
 
-        std::default_random_engine generator; 
-        std::uniform_int_distribution<int>* dist;
-    };
-}
+} // namespace Optimastic
 
 #endif // __RANDOM_HXX__
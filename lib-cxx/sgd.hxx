@@ -1,7 +1,10 @@
 #ifndef __SGD_HXX__
 #define __SGD_HXX__
 
+#include <vector>
+
 #include "random.hxx"
+#include "hogwild.hxx"
 #include "ifunction.hxx"
 #include "ioptimizer.hxx"
 
@@ -15,42 +18,55 @@ namespace Optimastic {
 
           SGD(Function f, Domain initial_condition,
               double step_size, double decay_offset,
-              random_int<Dimension> *prng_ptr,
+              random_int *prng_ptr,
               double friction_coefficient = 0.0, bool use_momentum = false)
-              : _current_min(initial_condition)
+              : IOptimizer<Function>(f)
+              , _current_min(initial_condition)
+              , _current_velocity(domain_zero<Domain>(initial_condition.size()))
               , _use_momentum(use_momentum)
               , _step_size(step_size)
               , _friction_coefficient(friction_coefficient)
+              , _decay(decay_offset)
+              , _nruns(0)
               , _prng_ptr(prng_ptr)
           {
               this->_current_step = 1; // actual step, not zero indexed, since we divide by this
+              this->check_prng(prng_ptr);
+          }
 
-              if (use_momentum) {
-                  // FIXME: Figure out how the correct default initialization should work for Eigen
-                  for (int i=0; i<Dimension; i++) { 
-                     _current_velocity[i] = 0;
-                  }
-              }
+          // Number of Hogwild workers used by run_optimizer; each worker keeps its own
+          // velocity and PRNG stream and writes into _current_min without locking.
+          // Without friction a step only writes the support of its partial gradient
+          //
+          // N.B. With friction every step adds the whole velocity, so the workers
+          // overwrite each other's steps; threads pay off for friction 0 only
+          //
+          // N.B. Sparse domains always run serially (see hogwild.hxx)
+          void set_num_threads(size_t nthreads) { 
+              _workers.set_num_threads(is_sparse_domain<Domain>::value ? 1 : nthreads);
+              _worker_velocities.resize(_workers.num_threads()-1, 
+                                        domain_zero<Domain>(_current_min.size()));
           }
 
+          size_t num_threads() const { 
+              return _workers.num_threads();
+          }
+
+          // Each call is one telemetry window
           void run_optimizer(size_t k) { 
-              size_t steps_left = k;
-              while (steps_left > 0) {
-                  // Setup loop constants
-                  double prefactor = -_step_size / (_decay + this->_current_step);
-                  int i = _prng_ptr->generate(); 
-
-                  // Accumulate velocity
-                  _current_velocity *= _friction_coefficient;
-                  this->_f.accum_partial_gradient(i, _current_min, _current_velocity, prefactor); 
-                  
-                  // Update argmin
-                  _current_min += _current_velocity;
-                  
-                  // Step update
-                  this->_current_step++;
-                  steps_left--;
-              }
+              const size_t first_step = this->_current_step;
+              this->_telemetry.begin_window(_nruns);
+
+              _workers.run(*_prng_ptr, first_step, k, 
+                           [&](size_t tid, random_int &prng, const StepRange &steps) {
+                  run_steps(prng, (tid == 0) ? _current_velocity : _worker_velocities[tid-1], steps);
+              });
+
+              this->_current_step += k;
+              this->_telemetry.end_window(_nruns, this->_current_step, 
+                  [&] { return min(); }, 
+                  [&] { return this->_f.full_gradient(_current_min).norm(); });
+              _nruns++;
           }
 
           const Domain& argmin() const { 
@@ -66,6 +82,38 @@ namespace Optimastic {
           }
 
         private:
+          // Worker loop over the global step numbers HogwildWorkers::run assigned it
+          void run_steps(random_int &prng, Domain &velocity, const StepRange &steps) { 
+              std::vector<int> batch(this->_batch_size);
+              std::vector<double> corrections;
+              // N.B. Step records only on one thread; Hogwild workers would race the norm
+              const bool serial = (num_threads() == 1);
+              for (size_t step : steps) { 
+                  // Setup loop constants
+                  double prefactor = -_step_size / (_decay + step);
+                  const double *weights = prng.fill(batch, corrections);
+
+                  // No velocity to carry over, so step argmin in place; this only
+                  // writes the batch's support, which is what keeps Hogwild sparse
+                  if (_friction_coefficient == 0.0) { 
+                      this->_f.accum_partial_gradients(batch.data(), this->_batch_size, _current_min, _current_min, 
+                                                       prefactor / this->_batch_size, weights); 
+                  } else { 
+                      // Accumulate velocity
+                      velocity *= _friction_coefficient;
+                      this->_f.accum_partial_gradients(batch.data(), this->_batch_size, _current_min, velocity, 
+                                                       prefactor / this->_batch_size, weights); 
+
+                      // Update argmin
+                      _current_min += velocity;
+                  }
+
+                  if (serial && this->_telemetry.step_sampled(step)) { 
+                      this->_telemetry.record_step(_nruns, step, _current_min.norm());
+                  }
+              }
+          }
+
           Domain _current_min;
           Domain _current_velocity;
 
@@ -76,8 +124,16 @@ namespace Optimastic {
           double _learning_rate;
           double _decay;
 
+          size_t _nruns;
+
+          random_int *_prng_ptr;
+
+          // Velocities of Hogwild workers 1.. (worker 0 uses _current_velocity), kept
+          // so that momentum carries over between run_optimizer calls
+          std::vector<Domain, aligned_allocator<Domain> > _worker_velocities;
 
-          random_int<Dimension> *_prng_ptr;
+          // Last (see thread_pool.hxx)
+          HogwildWorkers _workers;
     };
 
 } // namespace Optimastic
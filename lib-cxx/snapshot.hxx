@@ -0,0 +1,174 @@
+#ifndef __SNAPSHOT_HXX__
+#define __SNAPSHOT_HXX__
+
+//
+// SnapshotGradient owns the (point, full gradient) pair that SVRG and Katyusha
+// use as their control variate, and how it gets computed:
+//
+// 1. Serially, by Function::full_gradient (the default)
+// 2. In parallel: the components are split across a thread pool, each chunk is
+//    reduced by Function::accum_full_gradient into its own dense accumulator, and
+//    the accumulators are summed
+// 3. Pipelined: the gradient at the start of window k is computed in the background
+//    while window k runs on the snapshot from window k-1.  Any snapshot point keeps
+//    the estimator unbiased; the price is a one window stale control variate
+//
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "domain.hxx"
+#include "thread_pool.hxx"
+
+namespace Optimastic {
+
+template <typename Function>
+class SnapshotGradient {
+    public:
+        typedef typename Function::Domain Domain;
+        typedef Matrix<double, Dynamic, 1> Accumulator; // N.B. heap backed, so futures need no alignment
+
+        SnapshotGradient()
+            : _nthreads(1)
+            , _pipelined(false)
+            , _valid(false)
+        {}
+
+        SnapshotGradient(const SnapshotGradient &) = delete;
+
+        // Number of threads the full gradient is split across
+        void set_threads(size_t nthreads) {
+            wait_pending();
+            _nthreads = std::max(nthreads, size_t(1));
+            reset_pool();
+        }
+
+        size_t threads() const {
+            return _nthreads;
+        }
+
+        void set_pipelined(bool pipelined) {
+            wait_pending();
+            _pipelined = pipelined;
+            reset_pool();
+        }
+
+        bool pipelined() const {
+            return _pipelined;
+        }
+
+        // advance picks the snapshot for a window that starts at x; afterwards
+        // point() and gradient() hold the pair that window should use
+        void advance(const Function &f, const Domain &x) {
+            if (!_pipelined) {
+                _point    = x;
+                _gradient = compute(f, x);
+                _valid    = true;
+                return;
+            }
+
+            if (!_pending.empty()) {
+                collect();
+            } else if (!_valid) {
+                // Nothing to overlap with on the very first window
+                _point    = x;
+                _gradient = compute(f, x);
+                _valid    = true;
+                return;
+            }
+            launch(f, x);
+        }
+
+        const Domain &point() const {
+            return _point;
+        }
+
+        const Domain &gradient() const {
+            return _gradient;
+        }
+
+    private:
+        // Blocking full gradient at x, using the pool if there is one
+        Domain compute(const Function &f, const Domain &x) {
+            if (!_pool) {
+                return f.full_gradient(x);
+            }
+            launch(f, x);
+            collect();
+            return _gradient;
+        }
+
+        void reset_pool() {
+            size_t nworkers = (_nthreads > 1 || _pipelined) ? _nthreads : 0;
+            if (nworkers == 0) {
+                _pool.reset();
+            } else if (!_pool || _pool->size() != nworkers) {
+                _pool.reset(new ThreadPool(nworkers));
+            }
+        }
+
+        // Split [0, num_components) into one chunk per worker
+        void launch(const Function &f, const Domain &x) {
+            // N.B. _next_point is left alone until the chunks have been collected
+            _next_point = x;
+            const Domain *point = &_next_point;
+            const size_t ncomponents = f.num_components();
+            const size_t nchunks = _pool->size();
+            const int dim = x.size();
+
+            for (size_t c=0; c<nchunks; c++) {
+                size_t first = ncomponents * c / nchunks;
+                size_t last  = ncomponents * (c+1) / nchunks;
+                _pending.push_back(_pool->submit([&f, point, first, last, dim] {
+                    Accumulator acc = Accumulator::Zero(dim);
+                    f.accum_full_gradient(first, last, *point, acc);
+                    return acc;
+                }));
+            }
+        }
+
+        void collect() {
+            // Every chunk reads _next_point, so wait for all of them before get() can
+            // rethrow; _pending is emptied first so that nothing waits on them again
+            std::vector<std::future<Accumulator> > pending;
+            pending.swap(_pending);
+            for (auto &p : pending) {
+                p.wait();
+            }
+
+            Accumulator sum = pending[0].get();
+            for (size_t c=1; c<pending.size(); c++) {
+                sum += pending[c].get();
+            }
+
+            _point    = _next_point;
+            _gradient = domain_from_dense<Domain>(sum);
+            _valid    = true;
+        }
+
+        void wait_pending() {
+            for (auto &p : _pending) {
+                p.wait();
+            }
+            _pending.clear();
+        }
+
+        size_t _nthreads;
+        bool   _pipelined;
+        bool   _valid;
+
+        Domain _point;
+        Domain _gradient;
+
+        Domain _next_point;
+        std::vector<std::future<Accumulator> > _pending;
+
+        // Last (see thread_pool.hxx)
+        std::unique_ptr<ThreadPool> _pool;
+};
+
+} // namespace Optimastic
+
+#endif
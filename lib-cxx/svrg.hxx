@@ -1,7 +1,11 @@
 #ifndef __SVRG_HXX__
 #define __SVRG_HXX__
 
+#include <vector>
+
 #include "random.hxx"
+#include "hogwild.hxx"
+#include "snapshot.hxx"
 #include "ifunction.hxx"
 #include "ioptimizer.hxx"
 
@@ -15,22 +19,63 @@ namespace Optimastic {
 
           SVRG(Function f, Domain initial_condition,
               double step_size, double decay_offset,
-              size_t mb_size, random_int<Dimension> *prng_ptr)
-              : _current_min(initial_condition)
+              size_t mb_size, random_int *prng_ptr)
+              : IOptimizer<Function>(f)
+              , _current_min(initial_condition)
               , _step_size(step_size)
               , _decay(decay_offset)
               , _mb_size(mb_size)
               , _mb_nsteps(0)
+              , _lazy(false)
               , _prng_ptr(prng_ptr)
-
           {
               this->_current_step = 1; // actual step, not zero indexed, since we divide by this
+              this->check_prng(prng_ptr);
+
+          }
+
+          // Number of Hogwild workers that share each minibatch; the snapshot gradient
+          // is computed once per minibatch and the workers update mb_accum without locking.
+          // Threaded minibatches always use the lazy updates below, so that a step only
+          // writes the support of its partial gradients (see hogwild.hxx)
+          //
+          // N.B. Sparse domains always run serially (see hogwild.hxx)
+          void set_num_threads(size_t nthreads) { 
+              _workers.set_num_threads(is_sparse_domain<Domain>::value ? 1 : nthreads);
+          }
+
+          size_t num_threads() const { 
+              return _workers.num_threads();
+          }
+
+          // Snapshot gradient options (see snapshot.hxx): split each full gradient across
+          // nthreads threads, and/or compute the next minibatch's snapshot in the
+          // background while the current minibatch runs
+          void set_snapshot_threads(size_t nthreads) { 
+              _snapshot.set_threads(nthreads);
+          }
 
+          void set_pipelined_snapshot(bool pipelined) { 
+              _snapshot.set_pipelined(pipelined);
+          }
+
+          // Lazy ("just-in-time") updates: rather than adding prefactor * snapshot gradient
+          // to every coordinate on every step, each coordinate remembers how much of that
+          // dense term it has seen and catches up when Function::partial_support next
+          // touches it (and once more at the end of the minibatch).  The iterates are the
+          // same as the dense update, but a step costs O(support) instead of O(n).
+          void set_lazy_updates(bool lazy) { 
+              _lazy = lazy;
+          }
+
+          bool lazy_updates() const { 
+              return _lazy;
           }
 
           void run_single_batch() { 
-              size_t steps_left = _mb_size;
-              _mb_lru_gradient = this->_f.full_gradient(_current_min);
+              const size_t first_step = this->_current_step;
+              this->_telemetry.begin_window(_mb_nsteps);
+              _snapshot.advance(this->_f, _current_min);
 
               // mb_accum will serve as w_t in Algortihm 1 from the paper
               // 
@@ -38,30 +83,22 @@ namespace Optimastic {
               // Johnson, Zhang, NIPS, 2014
               //
               Domain mb_accum = _current_min;
-              
-              while (steps_left > 0) {
-                  // Setup loop constants
-                  double prefactor = -_step_size / (_decay + this->_current_step);
-                  int i = _prng_ptr->generate(); 
-
-                  // Compute partial gradient diff
-                  Domain grad_diff;
-                  for (int i=0; i<Dimension; i++) 
-                      grad_diff[i] = 0;
-                  
-                  // SVRG performs the following iterate:
-                  // 
-                  // w[t] = w[t-1] - step * ( grad_f(w[t-1]) - grad_f[_current_min] + _mb_lru_gradient ) 
-                  //
-                  this->_f.accum_partial_gradient(i, mb_accum, mb_accum, prefactor); 
-                  this->_f.accum_partial_gradient(i, _current_min, mb_accum, -prefactor);
-                  mb_accum += prefactor * _mb_lru_gradient;
 
-                  // Step update
-                  this->_current_step++;
-                  steps_left--;
+              if (_lazy || num_threads() > 1) { 
+                  begin_lazy(mb_accum.size());
+                  _workers.run(*_prng_ptr, first_step, _mb_size, 
+                               [&](size_t tid, random_int &prng, const StepRange &steps) {
+                      run_steps_lazy(prng, mb_accum, tid, steps);
+                  });
+              } else { 
+                  run_steps(*_prng_ptr, mb_accum, first_step);
               }
+
+              this->_current_step += _mb_size;
               _current_min = mb_accum;
+              this->_telemetry.end_window(_mb_nsteps, this->_current_step, 
+                  [&] { return min(); }, 
+                  [&] { return this->_f.full_gradient(_current_min).norm(); });
               _mb_nsteps++;
           }
 
@@ -84,6 +121,92 @@ namespace Optimastic {
           }
 
         private:
+          // Serial, dense minibatch
+          void run_steps(random_int &prng, Domain &mb_accum, size_t first_step) { 
+              std::vector<int> batch(this->_batch_size);
+              std::vector<double> corrections;
+              for (size_t j=0; j<_mb_size; j++) { 
+                  // Setup loop constants
+                  size_t step = first_step + j;
+                  double prefactor = -_step_size / (_decay + step);
+                  const double *weights = prng.fill(batch, corrections);
+
+                  // SVRG performs the following iterate:
+                  // 
+                  // w[t] = w[t-1] - step * ( grad_f(w[t-1]) - grad_f(snapshot) + full_grad_f(snapshot) ) 
+                  //
+                  // with grad_f averaged over the batch; the snapshot is _current_min
+                  // unless it is pipelined
+                  step_batch(batch, weights, mb_accum, prefactor);
+                  mb_accum += prefactor * _snapshot.gradient();
+
+                  if (this->_telemetry.step_sampled(step)) { 
+                      this->_telemetry.record_step(_mb_nsteps, step, mb_accum.norm());
+                  }
+              }
+          }
+
+          // Variance reduced part of an inner step, averaged over the batch
+          void step_batch(const std::vector<int> &batch, const double *weights, 
+                          Domain &mb_accum, double prefactor) { 
+              const double scale = prefactor / batch.size();
+              this->_f.accum_partial_gradients(batch.data(), batch.size(), mb_accum, mb_accum, scale, weights); 
+              this->_f.accum_partial_gradients(batch.data(), batch.size(), _snapshot.point(), mb_accum, -scale, weights);
+          }
+
+          // Minibatch with lazy updates of the snapshot gradient term, shared by the
+          // Hogwild workers.  Each worker owes the dense term for its own steps only:
+          // with sum the running total of the prefactors of worker tid's steps, and
+          // _lazy_stamps[tid][c] that total when the worker last brought coordinate c
+          // up to date, the worker owes c (sum - _lazy_stamps[tid][c]) * mu[c], and
+          // settles all of it once its steps are done.  A worker thus adds the dense
+          // term at the pace of its own steps, as a dense Hogwild worker would, however
+          // far ahead of or behind the others it runs (e.g. with more threads than
+          // cores); and only the iterate is shared
+          void begin_lazy(int dim) { 
+              _lazy_stamps.resize(num_threads());
+              for (auto &stamps : _lazy_stamps) { 
+                  stamps.assign(dim, 0.0);
+              }
+          }
+
+          // Worker loop over the global step numbers HogwildWorkers::run assigned it
+          void run_steps_lazy(random_int &prng, Domain &mb_accum, 
+                              size_t tid, const StepRange &steps) { 
+              const Domain &mu = _snapshot.gradient();
+              std::vector<double> &stamps = _lazy_stamps[tid];
+              double sum = 0.0;
+              std::vector<int> batch(this->_batch_size);
+              std::vector<double> corrections;
+              std::vector<int> support;
+
+              for (size_t step : steps) { 
+                  const double prefactor = -_step_size / (_decay + step);
+                  const double *weights = prng.fill(batch, corrections);
+                  support.clear();
+                  for (int i : batch) { 
+                      this->_f.partial_support(i, support);
+                  }
+
+                  // Catch up the coordinates this step reads
+                  for (int c : support) { 
+                      mb_accum.coeffRef(c) += (sum - stamps[c]) * mu.coeff(c);
+                      stamps[c] = sum;
+                  }
+
+                  step_batch(batch, weights, mb_accum, prefactor);
+                  sum += prefactor;
+              }
+
+              // Everything the worker still owes every coordinate
+              for (int c=0; c<mb_accum.size(); c++) { 
+                  double owed = (sum - stamps[c]) * mu.coeff(c);
+                  if (owed != 0.0) { 
+                      mb_accum.coeffRef(c) += owed;
+                  }
+              }
+          }
+
           // N.B. No momentum, because variance accelerated SGD w/ momentum is Katyusha
           Domain _current_min;
 
@@ -92,11 +215,18 @@ namespace Optimastic {
           double _decay;
 
           // minibatch parameters
-          Domain _mb_lru_gradient; 
           size_t _mb_size;
           size_t _mb_nsteps;
 
-          random_int<Dimension> *_prng_ptr;
+          // lazy update state
+          bool _lazy;
+          std::vector<std::vector<double> > _lazy_stamps;
+
+          random_int *_prng_ptr;
+
+          // Last (see thread_pool.hxx)
+          SnapshotGradient<Function> _snapshot;
+          HogwildWorkers _workers;
     };
 
 } // namespace Optimastic
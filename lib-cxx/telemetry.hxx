@@ -0,0 +1,286 @@
+#ifndef __TELEMETRY_HXX__
+#define __TELEMETRY_HXX__
+
+//
+// Telemetry records convergence traces from inside the optimizers without any
+// formatted I/O on the hot path.
+//
+// Each optimizer owns a Telemetry (IOptimizer::telemetry()) which, when sampling
+// is switched on, pushes fixed-size TelemetryRecords into a preallocated
+// single-producer / single-consumer ring:
+//
+// - Window records, every window_every windows (SGD: each run_optimizer call,
+//   SVRG: each minibatch, Katyusha: each window): step count, window wall time,
+//   and optionally the objective and gradient norm at the end of the window
+// - Step records, every step_every inner steps, with the iterate norm; only
+//   where the inner loop is serial and the iterate is materialized (see
+//   TelemetryOptions::step_every)
+//
+// The optimizer thread is the only producer.  Any one other thread may drain the
+// ring while the optimizer runs; a full ring drops new records (see dropped())
+// rather than ever blocking the optimizer.
+//
+// The whole thing is compiled in only when OPTIMASTIC_TELEMETRY is defined;
+// otherwise Telemetry keeps the same interface but every member is an empty
+// inline function, so the calls (and the arguments that would be evaluated for
+// them) vanish from the optimizers.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef OPTIMASTIC_TELEMETRY
+#include <atomic>
+#include <chrono>
+#include <limits>
+#endif
+
+namespace Optimastic {
+
+struct TelemetryRecord {
+    enum Kind { Window = 0, Step = 1 };
+
+    uint32_t kind;
+    uint64_t window;        // index of the window the record belongs to
+    uint64_t step;          // value of IOptimizer::_current_step
+    double   seconds;       // Window: wall time of the window; Step: NaN
+    double   objective;     // NaN unless sampled
+    double   gradient_norm; // NaN unless sampled
+    double   iterate_norm;  // NaN unless sampled
+};
+
+struct TelemetryOptions {
+    TelemetryOptions()
+        : capacity(1024)
+        , window_every(0)
+        , step_every(0)
+        , objective(true)
+        , gradient_norm(true)
+    {}
+
+    size_t capacity;     // records, rounded up to a power of two
+    size_t window_every; // 0 switches window records off
+    size_t step_every;   // 0 switches step records off
+
+    // Step records come from SGD on one thread, SVRG on one thread without lazy
+    // updates, and Katyusha without lazy updates; the Hogwild and lazy paths never
+    // materialize the iterate per step, so they only give window records
+
+    // What window records evaluate; each costs (at least) a pass over the data,
+    // but only on sampled windows and outside the timed region
+    bool objective;
+    bool gradient_norm;
+};
+
+#ifdef OPTIMASTIC_TELEMETRY
+
+// Lock-free SPSC ring of TelemetryRecords
+class TelemetryRing {
+    public:
+        explicit TelemetryRing(size_t capacity = 0) {
+            reset(capacity);
+        }
+
+        TelemetryRing(const TelemetryRing &) = delete;
+        TelemetryRing &operator=(const TelemetryRing &) = delete;
+
+        // N.B. Not safe against a concurrent push or pop
+        void reset(size_t capacity) {
+            size_t size = 1;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            _records.assign((capacity > 0) ? size : 0, TelemetryRecord());
+            _mask = size - 1;
+            _head.store(0, std::memory_order_relaxed);
+            _tail.store(0, std::memory_order_relaxed);
+            _dropped.store(0, std::memory_order_relaxed);
+        }
+
+        size_t capacity() const {
+            return _records.size();
+        }
+
+        // Producer side
+        bool push(const TelemetryRecord &r) {
+            const uint64_t head = _head.load(std::memory_order_relaxed);
+            if (head - _tail.load(std::memory_order_acquire) >= _records.size()) {
+                _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+            _records[head & _mask] = r;
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side
+        bool pop(TelemetryRecord &r) {
+            const uint64_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail == _head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            r = _records[tail & _mask];
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        uint64_t dropped() const {
+            return _dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::vector<TelemetryRecord> _records;
+        uint64_t _mask;
+
+        // Padded onto separate cache lines, so producer and consumer don't false
+        // share (N.B. padding rather than alignas, since C++14's new ignores
+        // over-alignment)
+        char _pad0[64];
+        std::atomic<uint64_t> _head;
+        char _pad1[64];
+        std::atomic<uint64_t> _tail;
+        char _pad2[64];
+        std::atomic<uint64_t> _dropped;
+};
+
+class Telemetry {
+    public:
+        static constexpr bool enabled = true;
+
+        Telemetry() {
+            configure(TelemetryOptions());
+        }
+
+        // Allocates the ring (and discards anything in it), so call this before
+        // the optimizer runs rather than while it does
+        void configure(const TelemetryOptions &options) {
+            _options = options;
+            _ring.reset((options.window_every || options.step_every) ? options.capacity : 0);
+        }
+
+        const TelemetryOptions &options() const {
+            return _options;
+        }
+
+        // Called at the start of every window; times it if it will be sampled
+        void begin_window(uint64_t window) {
+            if (window_sampled(window)) {
+                _window_start = Clock::now();
+            }
+        }
+
+        // Called at the end of every window; objective() and gradient_norm() are
+        // only invoked for sampled windows, after the clock has stopped
+        template <typename Objective, typename GradientNorm>
+        void end_window(uint64_t window, uint64_t step,
+                        Objective objective, GradientNorm gradient_norm) {
+            if (!window_sampled(window)) {
+                return;
+            }
+            TelemetryRecord r = blank(TelemetryRecord::Window, window, step);
+            r.seconds = std::chrono::duration<double>(Clock::now() - _window_start).count();
+            if (_options.objective) {
+                r.objective = objective();
+            }
+            if (_options.gradient_norm) {
+                r.gradient_norm = gradient_norm();
+            }
+            _ring.push(r);
+        }
+
+        // Inner loops test step_sampled() before paying for record_step's arguments
+        bool step_sampled(uint64_t step) const {
+            return _options.step_every && step % _options.step_every == 0;
+        }
+
+        void record_step(uint64_t window, uint64_t step, double iterate_norm) {
+            TelemetryRecord r = blank(TelemetryRecord::Step, window, step);
+            r.iterate_norm = iterate_norm;
+            _ring.push(r);
+        }
+
+        // Consumer side; these may run on another thread while the optimizer runs
+        bool pop(TelemetryRecord &r) {
+            return _ring.pop(r);
+        }
+
+        size_t drain(std::vector<TelemetryRecord> &out) {
+            size_t count = 0;
+            TelemetryRecord r;
+            while (_ring.pop(r)) {
+                out.push_back(r);
+                count++;
+            }
+            return count;
+        }
+
+        // Records lost to a full ring
+        uint64_t dropped() const {
+            return _ring.dropped();
+        }
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        bool window_sampled(uint64_t window) const {
+            return _options.window_every && window % _options.window_every == 0;
+        }
+
+        static TelemetryRecord blank(TelemetryRecord::Kind kind, uint64_t window, uint64_t step) {
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            TelemetryRecord r;
+            r.kind = kind;
+            r.window = window;
+            r.step = step;
+            r.seconds = r.objective = r.gradient_norm = r.iterate_norm = nan;
+            return r;
+        }
+
+        TelemetryOptions _options;
+        Clock::time_point _window_start;
+        TelemetryRing _ring;
+};
+
+#else // !OPTIMASTIC_TELEMETRY
+
+class Telemetry {
+    public:
+        static constexpr bool enabled = false;
+
+        void configure(const TelemetryOptions &) {}
+
+        const TelemetryOptions &options() const {
+            static const TelemetryOptions defaults;
+            return defaults;
+        }
+
+        void begin_window(uint64_t) {}
+
+        template <typename Objective, typename GradientNorm>
+        void end_window(uint64_t, uint64_t, Objective, GradientNorm) {}
+
+        constexpr bool step_sampled(uint64_t) const {
+            return false;
+        }
+
+        void record_step(uint64_t, uint64_t, double) {}
+
+        bool pop(TelemetryRecord &) {
+            return false;
+        }
+
+        size_t drain(std::vector<TelemetryRecord> &) {
+            return 0;
+        }
+
+        uint64_t dropped() const {
+            return 0;
+        }
+};
+
+#endif // OPTIMASTIC_TELEMETRY
+
+} // namespace Optimastic
+
+#endif
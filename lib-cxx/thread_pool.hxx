@@ -0,0 +1,98 @@
+#ifndef __THREAD_POOL_HXX__
+#define __THREAD_POOL_HXX__
+
+//
+// ThreadPool is a minimal fixed-size pool: submit() queues a task and returns a
+// future for its result.  The destructor finishes every queued task before joining,
+// so anything a task references only has to outlive the pool.
+//
+// Members are destroyed in reverse order, so a class that owns a pool (directly,
+// or through HogwildWorkers or SnapshotGradient) declares it last: the pool then
+// joins before any member its tasks might touch goes away.
+//
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace Optimastic {
+
+class ThreadPool {
+    public:
+        explicit ThreadPool(size_t nthreads)
+            : _stop(false)
+        {
+            if (nthreads == 0) {
+                nthreads = 1;
+            }
+            _workers.reserve(nthreads);
+            for (size_t t=0; t<nthreads; t++) {
+                _workers.emplace_back([this] { work(); });
+            }
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _wake.notify_all();
+            for (auto &w : _workers) {
+                w.join();
+            }
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        size_t size() const {
+            return _workers.size();
+        }
+
+        template <typename Task>
+        auto submit(Task task) -> std::future<decltype(task())> {
+            typedef decltype(task()) Result;
+
+            // std::function needs something copyable
+            auto job = std::make_shared<std::packaged_task<Result()> >(std::move(task));
+            std::future<Result> ret = job->get_future();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _queue.push([job] { (*job)(); });
+            }
+            _wake.notify_one();
+            return ret;
+        }
+
+    private:
+        void work() {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wake.wait(lock, [this] { return _stop || !_queue.empty(); });
+                    if (_queue.empty()) {
+                        return; // _stop, and nothing left to drain
+                    }
+                    job = std::move(_queue.front());
+                    _queue.pop();
+                }
+                job();
+            }
+        }
+
+        std::vector<std::thread> _workers;
+        std::queue<std::function<void()> > _queue;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        bool _stop;
+};
+
+} // namespace Optimastic
+
+#endif
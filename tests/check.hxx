@@ -0,0 +1,34 @@
+#ifndef __CHECK_HXX__
+#define __CHECK_HXX__
+
+//
+// What the self-checking test drivers share: every check prints one line ending
+// in ok or MISMATCH and returns whether it passed, so a driver counts its
+// failures (failures += !check(...)) and ends with return summary(failures),
+// which exits nonzero when anything failed (see tests/SConstruct)
+//
+
+#include <cstdarg>
+#include <cstdio>
+
+// A printf-style description, then the verdict
+inline bool check(bool ok, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf(" %s\n", ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+// value <= bound; N.B. a NaN value fails
+inline bool check_at_most(const char *what, double value, double bound) {
+    return check(value <= bound, "  %-44s %g (<= %g)", what, value, bound);
+}
+
+inline int summary(int failures) {
+    printf("%d failures\n", failures);
+    return (failures == 0) ? 0 : 1;
+}
+
+#endif
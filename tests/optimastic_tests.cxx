@@ -6,6 +6,7 @@
 
 // C++ includes
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -25,7 +26,7 @@ using namespace Optimastic;
 
 typedef std::vector<std::string> NameVec;
 
-void parse_args(int argc, char **argv, NameVec &names, size_t &max_dim, size_t &seed) {
+void parse_args(int argc, char **argv, NameVec &names, size_t &max_dim, size_t &seed, size_t &nthreads) {
     // Parse options
     extern char *optarg;
     int c;
@@ -35,11 +36,13 @@ void parse_args(int argc, char **argv, NameVec &names, size_t &max_dim, size_t &
         {
             { "method" , required_argument, 0, 'm' },
             { "max_dim", optional_argument, 0, 'd' },
-            { "seed"   , optional_argument, 0, 's' }
+            { "seed"   , optional_argument, 0, 's' },
+            { "threads", optional_argument, 0, 't' },
+            { 0        , 0                , 0, 0   }
         };
 
         int option_index = 0;
-        c = getopt_long (argc, argv, "m:d:s:",
+        c = getopt_long (argc, argv, "m:d:s:t:",
                 long_options, &option_index);
 
         if (c == -1) {
@@ -59,6 +62,10 @@ void parse_args(int argc, char **argv, NameVec &names, size_t &max_dim, size_t &
                 std::cout << "Seed: " << optarg << "\n";
                 seed = atoi(optarg);
                 break;
+            case 't':
+                std::cout << "Threads: " << optarg << "\n";
+                nthreads = atoi(optarg);
+                break;
             case '?':
                 break;
             default:
@@ -68,7 +75,7 @@ void parse_args(int argc, char **argv, NameVec &names, size_t &max_dim, size_t &
     }
 } 
 
-void run_tests(std::string &name) { 
+void run_tests(std::string &name, size_t nthreads) { 
     // FIXME: 
     // 1. This obviously will need to be more comprehensive in the future
     // 2. We should modularize this once we have a stable set of tests
@@ -80,8 +87,8 @@ void run_tests(std::string &name) {
     // Generate pnng
     std::cout << "Setting up random number generators\n";
     std::normal_distribution<>  norm_dist;
-    random_int<SMALL_DIMENSION> prngSmall;
-    random_int<BIG_DIMENSION>   prngBig;
+    random_int prngSmall(SMALL_DIMENSION);
+    random_int prngBig(BIG_DIMENSION);
 
     // Generate function
     std::cout << "Setting up quadratic test functions\n";
@@ -120,30 +127,31 @@ void run_tests(std::string &name) {
     }
     std::cout << "\n";
 
-    IOptimizer<Quadratic<SMALL_DIMENSION> > *opt_small; 
-    IOptimizer<Quadratic<BIG_DIMENSION> >   *opt_big;
+    std::unique_ptr<IOptimizer<Quadratic<SMALL_DIMENSION> > > opt_small; 
+    std::unique_ptr<IOptimizer<Quadratic<BIG_DIMENSION> > >   opt_big;
 
     if (name == "Katyusha") {  
         std::cout << "Setting up Katyusha instances\n";
-        Katyusha<Quadratic<SMALL_DIMENSION> >  kSmall (qSmall, initialSmall, 10.0, 0.5, 5, false, &prngSmall);
-        Katyusha<Quadratic<BIG_DIMENSION> >    kBig   (qBig, initialBig, 10.0, 0.5, 5, false, &prngBig);
-
-        opt_small = &kSmall;
-        opt_big   = &kBig;
+        opt_small.reset(new Katyusha<Quadratic<SMALL_DIMENSION> > (qSmall, initialSmall, 10.0, 0.5, 5, false, &prngSmall));
+        opt_big.reset(new Katyusha<Quadratic<BIG_DIMENSION> >     (qBig, initialBig, 10.0, 0.5, 5, false, &prngBig));
     } else if (name == "SGD") {
         std::cout << "Setting up SGD instances\n";
-        SGD<Quadratic<SMALL_DIMENSION> >  sgdSmall (qSmall, initialSmall, 1.0, 1.0, &prngSmall);
-        SGD<Quadratic<BIG_DIMENSION> >    sgdBig   (qBig,   initialBig,   1.0, 1.0, &prngBig);
+        auto sgdSmall = new SGD<Quadratic<SMALL_DIMENSION> > (qSmall, initialSmall, 1.0, 1.0, &prngSmall);
+        auto sgdBig   = new SGD<Quadratic<BIG_DIMENSION> >   (qBig,   initialBig,   1.0, 1.0, &prngBig);
+        sgdSmall->set_num_threads(nthreads);
+        sgdBig->set_num_threads(nthreads);
 
-        opt_small = &sgdSmall;
-        opt_big   = &sgdBig;
+        opt_small.reset(sgdSmall);
+        opt_big.reset(sgdBig);
     } else if (name == "SVRG") { 
         std::cout << "Setting up SVRG instances\n";
-        SVRG<Quadratic<SMALL_DIMENSION> >  svrgSmall (qSmall, initialSmall, 1.0, 1.0, 100, &prngSmall);
-        SVRG<Quadratic<BIG_DIMENSION> >    svrgBig   (qBig,   initialBig,   1.0, 1.0, 100, &prngBig);
+        auto svrgSmall = new SVRG<Quadratic<SMALL_DIMENSION> > (qSmall, initialSmall, 1.0, 1.0, 100, &prngSmall);
+        auto svrgBig   = new SVRG<Quadratic<BIG_DIMENSION> >   (qBig,   initialBig,   1.0, 1.0, 100, &prngBig);
+        svrgSmall->set_num_threads(nthreads);
+        svrgBig->set_num_threads(nthreads);
 
-        opt_small = &svrgSmall;
-        opt_big   = &svrgBig;
+        opt_small.reset(svrgSmall);
+        opt_big.reset(svrgBig);
     } else {
         std::cout << "Method name " << name << "not found, aborting";
         abort();
@@ -166,16 +174,16 @@ void run_tests(std::string &name) {
 
 int main(int argc, char **argv) { 
     NameVec methods;
-    size_t max_dim, seed;
-    parse_args(argc, argv, methods, max_dim, seed);
+    size_t max_dim, seed, nthreads = 1;
+    parse_args(argc, argv, methods, max_dim, seed, nthreads);
 
     if ( methods.size() == 0 ) {
-        printf("%s -m [method] -d [max_dim] -s [seed]\n", argv[0]);
+        printf("%s -m [method] -d [max_dim] -s [seed] -t [threads]\n", argv[0]);
         exit(1); 
     }
 
     for (auto name : methods) { 
-        run_tests(name);
+        run_tests(name, nthreads);
     }
 
     return 0;
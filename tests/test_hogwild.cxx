@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "check.hxx"
+#include "finite_sum.hxx"
+#include "hogwild.hxx"
+#include "random.hxx"
+#include "sgd.hxx"
+#include "svrg.hxx"
+
+#define NUM_SAMPLES 3000
+#define DIMENSION   200
+#define DENSITY     0.03
+#define NUM_THREADS 3
+
+using namespace Optimastic;
+
+typedef LeastSquares<Dynamic> Problem;
+
+static const double step_size = 20;
+static const double decay     = 100;
+
+// The serial algorithms, written out with the same batched kernel calls as the
+// optimizers; on one thread the optimizers have to reproduce these bit for bit
+static VectorXd serial_sgd(const Problem &f, VectorXd x, size_t nsteps) {
+    random_int prng(f.num_components());
+    for (size_t step=1; step<=nsteps; step++) {
+        const int i = prng.generate();
+        f.accum_partial_gradients(&i, 1, x, x, -step_size / (decay + step));
+    }
+    return x;
+}
+
+static VectorXd serial_svrg(const Problem &f, VectorXd x, size_t mb_size, size_t nbatches) {
+    random_int prng(f.num_components());
+    size_t step = 1;
+    for (size_t b=0; b<nbatches; b++) {
+        const VectorXd snapshot = x, mu = f.full_gradient(snapshot);
+        for (size_t j=0; j<mb_size; j++, step++) {
+            const double prefactor = -step_size / (decay + step);
+            const int i = prng.generate();
+            f.accum_partial_gradients(&i, 1, x, x, prefactor);
+            f.accum_partial_gradients(&i, 1, snapshot, x, -prefactor);
+            x += prefactor * mu;
+        }
+    }
+    return x;
+}
+
+// Every step in [first_step, first_step + nsteps) goes to exactly one worker, and
+// an exception only leaves run once every worker has finished
+static int check_workers() {
+    int failures = 0;
+    printf("HogwildWorkers:\n");
+
+    HogwildWorkers workers;
+    workers.set_num_threads(NUM_THREADS);
+    random_int prng(10);
+
+    const size_t first_step = 7, nsteps = 100;
+    std::vector<int> visits(nsteps, 0);
+    workers.run(prng, first_step, nsteps, [&](size_t, random_int &, const StepRange &steps) {
+        for (size_t step : steps) {
+            visits[step - first_step]++;
+        }
+    });
+    const long missed = std::count_if(visits.begin(), visits.end(), [](int v) { return v != 1; });
+    failures += !check_at_most("steps not visited exactly once", missed, 0);
+
+    std::atomic<int> finished(0);
+    bool caught = false;
+    try {
+        workers.run(prng, first_step, nsteps, [&](size_t tid, random_int &, const StepRange &) {
+            if (tid == 1) {
+                throw std::runtime_error("worker 1");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            finished++;
+        });
+    } catch (std::runtime_error &e) {
+        caught = true;
+    }
+    failures += !check_at_most("exception not rethrown", !caught, 0);
+    failures += !check_at_most("workers still running after the rethrow", NUM_THREADS - 1 - finished.load(), 0);
+
+    return failures;
+}
+
+int main(void) {
+    // A random sparse least squares problem with a zero residual minimum
+    std::mt19937 gen(1);
+    std::normal_distribution<>       norm_dist;
+    std::uniform_real_distribution<> unif_dist;
+
+    Eigen::SparseMatrix<double, Eigen::RowMajor> A(NUM_SAMPLES, DIMENSION);
+    std::vector<Eigen::Triplet<double> > entries;
+    for (int i=0; i<NUM_SAMPLES; i++) {
+        for (int j=0; j<DIMENSION; j++) {
+            if (unif_dist(gen) < DENSITY) {
+                entries.emplace_back(i, j, norm_dist(gen));
+            }
+        }
+    }
+    A.setFromTriplets(entries.begin(), entries.end());
+    VectorXd b = A * VectorXd::Random(DIMENSION);
+
+    const char *path = "test_hogwild.bin";
+    write_dataset(path, A, b);
+
+    int failures = check_workers();
+    {
+        Problem f(path);
+        const VectorXd initial = VectorXd::Zero(DIMENSION);
+        const size_t N = f.num_components();
+        const double f0 = f(initial);
+
+        printf("SGD:\n");
+        {
+            const VectorXd serial = serial_sgd(f, initial, 20*N);
+
+            random_int p1(N), p3(N);
+            SGD<Problem> one(f, initial, step_size, decay, &p1), three(f, initial, step_size, decay, &p3);
+            three.set_num_threads(NUM_THREADS);
+            // Split the steps across calls; the step numbering carries over
+            one.run_optimizer(5*N);
+            one.run_optimizer(15*N);
+            three.run_optimizer(20*N);
+
+            failures += !check_at_most("1 thread |serial - SGD|", (serial - one.argmin()).norm(), 0);
+            failures += !check_at_most("3 threads f(x) / f(x0)", three.min() / f0, 0.02);
+            failures += !check_at_most("3 threads f(x) / (1 thread f(x))", three.min() / one.min(), 2);
+        }
+
+        printf("SVRG:\n");
+        {
+            const size_t mb_size = N, nbatches = 10;
+            const VectorXd serial = serial_svrg(f, initial, mb_size, nbatches);
+
+            random_int p1(N), p1l(N), p3(N);
+            SVRG<Problem> one(f, initial, step_size, decay, mb_size, &p1);
+            SVRG<Problem> one_lazy(f, initial, step_size, decay, mb_size, &p1l);
+            SVRG<Problem> three(f, initial, step_size, decay, mb_size, &p3);
+            one_lazy.set_lazy_updates(true);
+            three.set_num_threads(NUM_THREADS);
+            one.run_optimizer(nbatches);
+            one_lazy.run_optimizer(nbatches);
+            three.run_optimizer(nbatches);
+
+            // One lazy thread runs through HogwildWorkers; lazy updates only reorder
+            // the arithmetic of the dense steps
+            failures += !check_at_most("1 thread |serial - SVRG|", (serial - one.argmin()).norm(), 0);
+            failures += !check_at_most("1 lazy thread |serial - SVRG| / |serial|",
+                                       (serial - one_lazy.argmin()).norm() / serial.norm(), 1e-13);
+            // N.B. A worker running behind restarts the decaying step size, so with
+            // fewer cores than threads Hogwild trails the serial run somewhat
+            failures += !check_at_most("3 threads f(x) / f(x0)", three.min() / f0, 0.02);
+            failures += !check_at_most("3 threads f(x) / (1 thread f(x))", three.min() / one.min(), 3);
+
+            // Steps large enough that a worker must never undo another's dense term
+            random_int pa(N);
+            SVRG<Problem> aggressive(f, initial, 150*step_size, 300*decay, mb_size, &pa);
+            aggressive.set_num_threads(NUM_THREADS);
+            aggressive.run_optimizer(nbatches);
+            failures += !check_at_most("3 threads, large steps f(x) / f(x0)", aggressive.min() / f0, 0.02);
+        }
+    }
+    std::remove(path);
+
+    return summary(failures);
+}
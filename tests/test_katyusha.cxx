@@ -17,8 +17,8 @@ int main(void) {
     // Generate pnng
     std::cout << "Setting up random number generators\n";
     std::normal_distribution<>  norm_dist;
-    random_int<SMALL_DIMENSION> prngSmall;
-    random_int<BIG_DIMENSION>   prngBig;
+    random_int prngSmall(SMALL_DIMENSION);
+    random_int prngBig(BIG_DIMENSION);
 
     // Generate function
     std::cout << "Setting up quadratic test functions\n";
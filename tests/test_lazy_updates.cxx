@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "check.hxx"
+#include "finite_sum.hxx"
+#include "katyusha.hxx"
+#include "random.hxx"
+#include "svrg.hxx"
+
+#define NUM_SAMPLES 3000
+#define DIMENSION   200
+#define DENSITY     0.03
+
+using namespace Optimastic;
+
+// Lazy updates only reorder the arithmetic of the dense steps, so the two should
+// agree to within rounding
+static const double tolerance = 1e-13;
+
+static bool close(const char *what, double diff, double norm) {
+    return check(diff <= tolerance * std::max(norm, 1.0),
+                 "  %-10s dense vs lazy: |diff| %g, |x| %g", what, diff, norm);
+}
+
+template <typename F>
+int compare(const char *name, const F &f, const typename F::Domain &initial) {
+    const int N = f.num_components();
+    random_int p1(N), p2(N), p3(N), p4(N);
+    int failures = 0;
+    printf("%s:\n", name);
+
+    SVRG<F> dense_svrg(f, initial, 0.5, 10, 500, &p1), lazy_svrg(f, initial, 0.5, 10, 500, &p2);
+    lazy_svrg.set_lazy_updates(true);
+    dense_svrg.run_optimizer(5);
+    lazy_svrg.run_optimizer(5);
+    failures += !close("SVRG", (dense_svrg.argmin() - lazy_svrg.argmin()).norm(),
+                       dense_svrg.argmin().norm());
+
+    Katyusha<F> dense_kat(f, initial, 5.0, 0.05, 300, false, &p3);
+    Katyusha<F> lazy_kat(f, initial, 5.0, 0.05, 300, false, &p4);
+    lazy_kat.set_lazy_updates(true);
+    dense_kat.run_optimizer(5);
+    lazy_kat.run_optimizer(5);
+    failures += !close("Katyusha", (dense_kat.argmin() - lazy_kat.argmin()).norm(),
+                       dense_kat.argmin().norm());
+
+    return failures;
+}
+
+int main(void) {
+    // A random sparse least squares problem, about DENSITY*DIMENSION entries per row
+    std::mt19937 gen(1);
+    std::normal_distribution<>       norm_dist;
+    std::uniform_real_distribution<> unif_dist;
+
+    Eigen::SparseMatrix<double, Eigen::RowMajor> A(NUM_SAMPLES, DIMENSION);
+    std::vector<Eigen::Triplet<double> > entries;
+    for (int i=0; i<NUM_SAMPLES; i++) {
+        for (int j=0; j<DIMENSION; j++) {
+            if (unif_dist(gen) < DENSITY) {
+                entries.emplace_back(i, j, norm_dist(gen));
+            }
+        }
+    }
+    A.setFromTriplets(entries.begin(), entries.end());
+    VectorXd b = A * VectorXd::Random(DIMENSION);
+
+    const char *path = "test_lazy_updates.bin";
+    write_dataset(path, A, b);
+
+    int failures = 0;
+    {
+        LeastSquares<> f(path);
+        failures += compare("LeastSquares<>", f, VectorXd::Zero(DIMENSION));
+
+        LeastSquares<Dynamic, SparseVector<double> > fs(path);
+        failures += compare("LeastSquares<Dynamic, SparseVector>", fs, SparseVector<double>(DIMENSION));
+
+        // A block size of 0 streams one row at a time rather than never advancing
+        LeastSquares<> f0(path, 0);
+        const VectorXd x = VectorXd::Ones(DIMENSION);
+        const double diff = (f0.full_gradient(x) - f.full_gradient(x)).norm();
+        failures += !check(diff <= tolerance * f.full_gradient(x).norm(),
+                           "block_rows 0 vs 4096: |diff| %g", diff);
+    }
+    std::remove(path);
+
+    return summary(failures);
+}
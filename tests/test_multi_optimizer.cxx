@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "check.hxx"
+#include "finite_sum.hxx"
+#include "function.hxx"
+#include "katyusha.hxx"
+#include "multi_optimizer.hxx"
+#include "random.hxx"
+#include "sgd.hxx"
+#include "svrg.hxx"
+
+#define NUM_INSTANCES 11 // one full tile and a padded one
+#define NUM_WINDOWS   5
+#define NUM_SAMPLES   300
+#define DIMENSION     40
+#define DENSITY       0.1
+
+using namespace Optimastic;
+
+// Instance k of a MultiOptimizer follows the single-instance optimizer drawing
+// from stream k step for step; only the order of floating point operations may
+// differ (e.g. FMA contraction of the vectorized rows)
+static const double tolerance = 1e-12;
+
+static const char *method_names[] = { "SGD", "SVRG", "Katyusha" };
+
+// A least squares problem that only provides the required members, so that
+// MultiOptimizer goes through IFunction's default (gather / scatter) SoA kernel
+struct RowByRow final : public IFunction<RowByRow, Dynamic> {
+    explicit RowByRow(const LeastSquares<> &f)
+        : _f(f)
+    {}
+
+    int dimension() const {
+        return _f.dimension();
+    }
+
+    int num_components() const {
+        return _f.num_components();
+    }
+
+    void accum_partial_gradient(int i, const Domain &x, Domain &grad, double step_size) const {
+        _f.accum_partial_gradient(i, x, grad, step_size);
+    }
+
+    Domain full_gradient(const Domain &x) const {
+        return _f.full_gradient(x);
+    }
+
+    double operator()(const Domain &x) const {
+        return _f(x);
+    }
+
+    void partial_support(int i, std::vector<int> &coords) const {
+        _f.partial_support(i, coords);
+    }
+
+    const LeastSquares<> &_f;
+};
+
+template <typename F>
+std::unique_ptr<IOptimizer<F> > single_optimizer(const F &f, MultiMethod method, const VectorXd &initial,
+                                                 const MultiSettings &s, random_int *prng) {
+    switch (method) {
+        case MultiMethod::SGD:
+            return std::unique_ptr<IOptimizer<F> >(new SGD<F>(f, initial, s.step_size, s.decay_offset,
+                                                              prng, s.friction_coefficient));
+        case MultiMethod::SVRG:
+            return std::unique_ptr<IOptimizer<F> >(new SVRG<F>(f, initial, s.step_size, s.decay_offset,
+                                                               s.mb_size, prng));
+        default:
+            return std::unique_ptr<IOptimizer<F> >(new Katyusha<F>(f, initial, s.lipschitz_constant,
+                                                                   s.convexity_modulus, s.window_size,
+                                                                   s.proximal, prng));
+    }
+}
+
+template <typename F>
+int compare(const char *name, const F &f) {
+    const int d = f.dimension(), N = f.num_components();
+    int failures = 0;
+
+    // A sweep: every instance gets its own step size / convexity modulus and
+    // initial condition
+    MatrixXd initial(d, NUM_INSTANCES);
+    std::vector<MultiSettings> settings(NUM_INSTANCES);
+    for (int k=0; k<NUM_INSTANCES; k++) {
+        initial.col(k) = VectorXd::Constant(d, 0.3 + 0.05*k);
+
+        MultiSettings &s = settings[k];
+        s.step_size            = 300 * (1 + 0.05*k);
+        s.decay_offset         = 1000;
+        s.friction_coefficient = 0.2;
+        s.mb_size              = N;
+        s.lipschitz_constant   = 3;
+        s.convexity_modulus    = 0.01 * (1 + 0.1*k);
+        s.window_size          = N;
+        s.proximal             = (k % 2 == 1);
+    }
+
+    for (int m=0; m<3; m++) {
+        const MultiMethod method = MultiMethod(m);
+
+        // Split the steps unevenly across calls and threads; neither may matter
+        MultiOptimizer<F> multi(f, method, initial, settings);
+        multi.set_num_threads(3);
+        multi.run_optimizer(2*N);
+        multi.run_optimizer((NUM_WINDOWS-2)*N);
+
+        double worst = 0;
+        for (int k=0; k<NUM_INSTANCES; k++) {
+            random_int prng(N, SEED, k);
+            std::unique_ptr<IOptimizer<F> > single = single_optimizer(f, method, initial.col(k), settings[k], &prng);
+            // SGD counts steps, SVRG and Katyusha count windows of N steps
+            single->run_optimizer((method == MultiMethod::SGD) ? NUM_WINDOWS*N : NUM_WINDOWS);
+
+            const double diff = (single->argmin() - multi.argmin(k)).norm();
+            const double relative = diff / std::max(single->argmin().norm(), 1.0);
+            if (!(relative <= worst)) {
+                worst = relative; // N.B. keeps a NaN, which std::max would drop
+            }
+        }
+        failures += !check(worst <= tolerance, "%s, %-8s: worst relative |single - multi| over %d instances %g",
+                           name, method_names[m], NUM_INSTANCES, worst);
+    }
+
+    return failures;
+}
+
+// Settings that would divide by zero (or give NaN) have to be rejected up front
+static int check_rejected(const char *what, MultiMethod method, const MultiSettings &bad) {
+    Quadratic<Dynamic> q(4);
+    std::vector<MultiSettings> settings(3);
+    settings[0].convexity_modulus = settings[2].convexity_modulus = 0.1;
+    settings[1] = bad;
+
+    bool rejected = false;
+    try {
+        MultiOptimizer<Quadratic<Dynamic> > multi(q, method, MatrixXd::Ones(4, 3), settings);
+    } catch (std::invalid_argument &e) {
+        rejected = true;
+    }
+    return !check(rejected, "%-28s rejected:", what);
+}
+
+int main(void) {
+    int failures = 0;
+
+    Quadratic<8> q8;
+    failures += compare("Quadratic<8>", q8);
+
+    Quadratic<Dynamic>::Coefficients coef = (VectorXd::Random(40).array() + 1.5).matrix();
+    Quadratic<Dynamic>::Coefficients shift = VectorXd::Random(40);
+    failures += compare("Quadratic<Dynamic>", Quadratic<Dynamic>(coef, shift));
+
+    // A random sparse least squares problem, through FiniteSum's own SoA kernel
+    // and through the default one
+    std::mt19937 gen(1);
+    std::normal_distribution<>       norm_dist;
+    std::uniform_real_distribution<> unif_dist;
+
+    Eigen::SparseMatrix<double, Eigen::RowMajor> A(NUM_SAMPLES, DIMENSION);
+    std::vector<Eigen::Triplet<double> > entries;
+    for (int i=0; i<NUM_SAMPLES; i++) {
+        for (int j=0; j<DIMENSION; j++) {
+            if (unif_dist(gen) < DENSITY) {
+                entries.emplace_back(i, j, norm_dist(gen));
+            }
+        }
+    }
+    A.setFromTriplets(entries.begin(), entries.end());
+    VectorXd b = A * VectorXd::Random(DIMENSION);
+
+    const char *path = "test_multi_optimizer.bin";
+    write_dataset(path, A, b);
+    {
+        LeastSquares<> lsq(path);
+        failures += compare("LeastSquares<>", lsq);
+        failures += compare("RowByRow", RowByRow(lsq));
+    }
+    std::remove(path);
+
+    MultiSettings zero_mb, zero_window, zero_modulus;
+    zero_mb.mb_size = 0;
+    zero_window.convexity_modulus = 0.1;
+    zero_window.window_size = 0;
+    failures += check_rejected("SVRG mb_size 0", MultiMethod::SVRG, zero_mb);
+    failures += check_rejected("Katyusha window_size 0", MultiMethod::Katyusha, zero_window);
+    failures += check_rejected("Katyusha convexity_modulus 0", MultiMethod::Katyusha, zero_modulus);
+
+    return summary(failures);
+}
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+#include "check.hxx"
+#include "random.hxx"
+
+using namespace Optimastic;
+
+// Known answers for Philox4x32-10 (kat_vectors from the Random123 distribution)
+struct KnownAnswer {
+    uint32_t counter[4];
+    uint32_t key[2];
+    uint32_t expected[4];
+};
+
+static const KnownAnswer known_answers[] = {
+    { { 0x00000000u, 0x00000000u, 0x00000000u, 0x00000000u },
+      { 0x00000000u, 0x00000000u },
+      { 0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u } },
+    { { 0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu },
+      { 0xffffffffu, 0xffffffffu },
+      { 0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu } },
+    { { 0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u },
+      { 0xa4093822u, 0x299f31d0u },
+      { 0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u } },
+};
+
+int main(void) {
+    int failures = 0;
+
+    // The published vectors
+    for (const KnownAnswer &ka : known_answers) {
+        uint32_t out[4];
+        philox4x32::block(ka.counter, ka.key, out);
+        bool ok = true;
+        for (int w=0; w<4; w++) {
+            ok = ok && (out[w] == ka.expected[w]);
+        }
+        failures += !check(ok, "block(%08x %08x %08x %08x): %08x %08x %08x %08x",
+                           ka.counter[0], ka.counter[1], ka.counter[2], ka.counter[3],
+                           out[0], out[1], out[2], out[3]);
+    }
+
+    // The generator is block k of stream s, counter (k lo, k hi, s lo, s hi)
+    const uint64_t seed = 0x0123456789abcdefull, stream = 0xfedcba9876543210ull;
+    {
+        philox4x32 gen(seed, stream);
+        const uint32_t key[2] = { uint32_t(seed), uint32_t(seed >> 32) };
+        bool ok = true;
+        for (uint64_t k=0; k<100; k++) {
+            const uint32_t counter[4] = { uint32_t(k), uint32_t(k >> 32),
+                                          uint32_t(stream), uint32_t(stream >> 32) };
+            uint32_t out[4];
+            philox4x32::block(counter, key, out);
+            for (int w=0; w<4; w++) {
+                ok = ok && (gen() == out[w]);
+            }
+        }
+        failures += !check(ok, "operator() follows block():");
+    }
+
+    // fill() gives the same words as operator(), from any starting offset and
+    // across the Width block boundary
+    {
+        bool ok = true;
+        for (size_t offset : { 0, 1, 3, 5 }) {
+            for (size_t count : { 0, 1, 7, 64, 65, 300 }) {
+                philox4x32 a(seed, stream), b(seed, stream);
+                for (size_t k=0; k<offset; k++) {
+                    a();
+                    b();
+                }
+                std::vector<uint32_t> words(count);
+                a.fill(words.data(), count);
+                for (size_t k=0; k<count; k++) {
+                    ok = ok && (words[k] == b());
+                }
+                ok = ok && (a() == b());
+            }
+        }
+        failures += !check(ok, "fill() matches operator():");
+    }
+
+    // random_int: fill() draws what generate() would, inside [0, size)
+    {
+        const int size = 37;
+        random_int a(size, seed), b(size, seed);
+        std::vector<int> draws(1000);
+        a.fill(draws.data(), draws.size());
+        bool ok = true;
+        for (int d : draws) {
+            ok = ok && (d == b.generate()) && (d >= 0) && (d < size);
+        }
+        failures += !check(ok, "random_int fill() matches generate():");
+    }
+
+    // Importance sampling: frequencies follow the weights (within 5 standard
+    // deviations), zero weights are never drawn, and correction(i) == 1/(n p_i)
+    {
+        const int size = 8;
+        const std::vector<double> weights = { 1, 2, 3, 4, 0, 10, 0.5, 7.5 };
+        const double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+        const int ndraws = 400000;
+
+        random_int r(size, seed);
+        r.set_weights(weights);
+        std::vector<int> counts(size, 0);
+        for (int k=0; k<ndraws; k++) {
+            counts[r.generate()]++;
+        }
+
+        double worst = 0, worst_correction = 0;
+        for (int i=0; i<size; i++) {
+            const double p = weights[i] / total;
+            if (p == 0) {
+                worst = std::max(worst, (counts[i] > 0) ? HUGE_VAL : 0.0);
+                continue;
+            }
+            const double sigma = std::sqrt(p * (1-p) / ndraws);
+            worst = std::max(worst, std::abs(double(counts[i]) / ndraws - p) / sigma);
+            worst_correction = std::max(worst_correction, std::abs(r.correction(i) * size * p - 1));
+        }
+        failures += !check(worst <= 5, "weighted frequencies: worst %g sigma", worst);
+        failures += !check(worst_correction <= 1e-12, "correction == 1/(n p): worst relative error %g",
+                           worst_correction);
+
+        // fill() draws what generate() would, with the matching corrections
+        random_int a(size, seed, 1), b(size, seed, 1);
+        a.set_weights(weights);
+        b.set_weights(weights);
+        bool same = true;
+        for (size_t count : { 1, 7, 300, 1000 }) {
+            std::vector<int> batch(count);
+            std::vector<double> corrections;
+            const double *c = a.fill(batch, corrections);
+            same = same && (c == corrections.data());
+            for (size_t k=0; k<count; k++) {
+                same = same && (batch[k] == b.generate()) && (c[k] == b.correction(batch[k]));
+            }
+        }
+        failures += !check(same, "weighted fill() matches generate():");
+    }
+
+    // Without replacement: every epoch is a permutation of [0, size), in a fresh
+    // order, whether drawn by generate() or fill()
+    {
+        const int size = 50, nepochs = 4;
+        random_int r(size, seed), f(size, seed);
+        r.set_without_replacement(true);
+        f.set_without_replacement(true);
+        std::vector<int> identity(size);
+        std::iota(identity.begin(), identity.end(), 0);
+
+        bool permutations = true, fresh = true, same = true;
+        std::vector<int> previous;
+        for (int e=0; e<nepochs; e++) {
+            std::vector<int> epoch(size), filled(size);
+            for (int &i : epoch) {
+                i = r.generate();
+            }
+            f.fill(filled.data(), size);
+            same = same && (epoch == filled);
+            fresh = fresh && (epoch != previous);
+            previous = epoch;
+            std::sort(epoch.begin(), epoch.end());
+            permutations = permutations && (epoch == identity);
+        }
+        failures += !check(permutations, "without replacement, every epoch is a permutation:");
+        failures += !check(fresh, "without replacement, every epoch is reshuffled:");
+        failures += !check(same, "without replacement, fill() matches generate():");
+    }
+
+    // split() is reproducible, and the split stream differs from its parent
+    {
+        random_int a(1000, seed), b(1000, seed);
+        random_int sa = a.split(), sb = b.split();
+        bool same = true, differs = false;
+        for (int k=0; k<100; k++) {
+            const int x = sa.generate();
+            same = same && (x == sb.generate());
+            differs = differs || (x != a.generate());
+        }
+        failures += !check(same, "split() reproducible:");
+        failures += !check(differs, "split() independent of parent:");
+    }
+
+    return summary(failures);
+}